@@ -7,5 +7,24 @@ VERSION = 1.3
 PREFIX = /usr/local
 MANPREFIX = $(PREFIX)/share/man
 
+# Set to 1 to compile in USDT probes (needs sys/sdt.h from systemtap)
+USDT = 0
+
+# make bench: numbers of processes, wait backends and sleep times to measure.
+# 100000 processes need kernel.pid_max and the process limit raised above it
+BENCH_N = 1 100 1000 10000 100000
+BENCH_BACKENDS = poll latency
+BENCH_SLEEP = 1s 100ms 10ms
+
+# make stress: PID reuse stress test. Lowering pid_max needs root
+STRESS_ARGS = -n 2000 -c 4 -d 10 -m 4096 -- -s 500ms
+
+# make parsefuzz / make fuzz: compiler and flags for the parser fuzzing
+# harness. For AFL use FUZZCC = afl-clang-fast and empty FUZZFLAGS
+FUZZCC = clang
+FUZZFLAGS = -DLIBFUZZER -fsanitize=fuzzer,address,undefined
+FUZZARGS = -max_total_time=60
+
 CC = cc
+LIBS = -lpthread
 CFLAGS = -std=c99 -g -Wall -Wextra -pedantic -D_POSIX_C_SOURCE=199309L -D_DEFAULT_SOURCE
@@ -0,0 +1,280 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "execwatch.h"
+#include "go.h"
+#include "procfs.h"
+#include "stats.h"
+
+/* room for a batch of process events */
+#define CN_BUF_LEN 8192
+
+/* the program of a process as captured at start */
+struct image {
+	unsigned pid;
+	bool exe_known;		/* exe could be read */
+	bool exec_seen;		/* exec event was received */
+	bool execd;		/* executed a different program */
+	dev_t dev;		/* device and inode of the executable */
+	ino_t ino;
+	uint32_t text;		/* size of the program text */
+	char name[PNAME_LEN];
+};
+
+/* sorted by pid */
+static struct image *images = NULL;
+static size_t nimages = 0;
+
+/* process event connector, -1 if not subscribed */
+static int cn_sock = -1;
+
+/* events were dropped since the previous tick */
+static bool cn_lost = false;
+
+
+static int cmp_image (const void *a, const void *b)
+{
+	unsigned pa = ((const struct image *) a)->pid;
+	unsigned pb = ((const struct image *) b)->pid;
+
+	return (pa > pb) - (pa < pb);
+}
+
+
+static struct image * find_image (const unsigned pid)
+{
+	struct image key = { .pid = pid };
+
+	return bsearch(&key, images, nimages, sizeof(*images), cmp_image);
+}
+
+
+static int read_exe (const unsigned pid, dev_t * restrict dev,
+		     ino_t * restrict ino)
+{
+	char path[PROCFS_PATH_LEN];
+	struct stat st;
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "%u/exe", pid) != E_SUCCESS)
+		return E_FAIL;
+
+	stats_count(SC_OPENS, 1);
+	if (stat(path, &st) == -1)
+		return E_FAIL;
+
+	*dev = st.st_dev;
+	*ino = st.st_ino;
+	return E_SUCCESS;
+}
+
+
+/* check that nlh is a whole process event message */
+static bool cn_valid (const struct nlmsghdr * const nlh)
+{
+	const struct cn_msg *cn = NLMSG_DATA(nlh);
+
+	if (nlh->nlmsg_type != NLMSG_DONE ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*cn) +
+					  sizeof(struct proc_event)))
+		return false;
+
+	return cn->id.idx == CN_IDX_PROC && cn->id.val == CN_VAL_PROC &&
+	       cn->len >= sizeof(struct proc_event);
+}
+
+
+static int cn_send (const enum proc_cn_mcast_op op)
+{
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	struct cn_msg *cn = NLMSG_DATA(nlh);
+
+	memset(buf, 0, sizeof(buf));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*cn) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_pid = (uint32_t) getpid();
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+
+	return send(cn_sock, buf, nlh->nlmsg_len, 0) == -1 ? E_FAIL : E_SUCCESS;
+}
+
+
+/* subscribing needs CAP_NET_ADMIN */
+static int cn_open (void)
+{
+	struct sockaddr_nl sa;
+
+	cn_sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			 NETLINK_CONNECTOR);
+	if (cn_sock == -1)
+		return E_FAIL;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	if (bind(cn_sock, (struct sockaddr *) &sa, sizeof(sa)) == -1 ||
+	    cn_send(PROC_CN_MCAST_LISTEN) != E_SUCCESS) {
+		close(cn_sock);
+		cn_sock = -1;
+		return E_FAIL;
+	}
+
+	return E_SUCCESS;
+}
+
+
+int execwatch_start (const struct proclist * proclist)
+{
+	const struct proc *proc;
+	size_t n = 0;
+
+	/* subscribe first so that no exec goes unnoticed after capturing */
+	if (cn_open() == E_SUCCESS)
+		go(GO_INFO, "Reading exec events from the process connector\n");
+	else
+		go(GO_INFO, "Process connector not available (%s), comparing "
+			    "executables\n", strerror(errno));
+
+	SLIST_FOREACH(proc, proclist, procs)
+		++n;
+	images = calloc(n ? n : 1, sizeof(*images));
+	if (images == NULL)
+		return E_FAIL;
+
+	/* threads exec only by taking over their whole process */
+	SLIST_FOREACH(proc, proclist, procs) {
+		struct image *img = &images[nimages];
+
+		if (proc->tgid != 0)
+			continue;
+
+		img->pid = proc->pid;
+		img->exe_known = read_exe(proc->pid, &img->dev, &img->ino)
+				 == E_SUCCESS;
+		img->text = proc->text;
+		memcpy(img->name, proc->name, PNAME_LEN);
+		++nimages;
+	}
+	qsort(images, nimages, sizeof(*images), cmp_image);
+
+	return E_SUCCESS;
+}
+
+
+void execwatch_tick (void)
+{
+	char buf[CN_BUF_LEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct sockaddr_nl from;
+	socklen_t from_len;
+	ssize_t len;
+
+	if (cn_sock == -1)
+		return;
+
+	cn_lost = false;
+	for (;;) {
+		struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+
+		from_len = sizeof(from);
+		len = recvfrom(cn_sock, buf, sizeof(buf), 0,
+			       (struct sockaddr *) &from, &from_len);
+		if (len == 0)
+			break;
+		if (len == -1) {
+			/* the socket buffer overflowed */
+			if (errno == ENOBUFS) {
+				cn_lost = true;
+				continue;
+			}
+			break;
+		}
+
+		/* only the kernel sends process events */
+		stats_count(SC_BYTES, (uint64_t) len);
+		if (from.nl_pid != 0)
+			continue;
+
+		for (; NLMSG_OK(nlh, (size_t) len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			struct cn_msg *cn = NLMSG_DATA(nlh);
+			struct proc_event *ev = (struct proc_event *) cn->data;
+			struct image *img;
+
+			if (!cn_valid(nlh) || ev->what != PROC_EVENT_EXEC)
+				continue;
+
+			img = find_image((unsigned)
+					 ev->event_data.exec.process_tgid);
+			if (img != NULL)
+				img->exec_seen = true;
+		}
+	}
+}
+
+
+bool execwatch_check (const struct proc * const p,
+		      const struct proc * const sample)
+{
+	struct image *img = find_image(p->pid);
+	dev_t dev;
+	ino_t ino;
+
+	if (img == NULL)
+		return false;
+	if (img->execd)
+		return true;
+
+	if (cn_sock != -1 && !cn_lost) {
+		if (!img->exec_seen)
+			return false;
+		img->exec_seen = false;
+	} else if (sample->text == img->text &&
+		   !strcmp(sample->name, img->name)) {
+		/* without events the executable is only compared once the
+		 * name or the size of the program text read from stat have
+		 * changed */
+		return false;
+	}
+
+	if (img->exe_known && read_exe(p->pid, &dev, &ino) == E_SUCCESS) {
+		img->execd = dev != img->dev || ino != img->ino;
+	} else {
+		img->execd = strcmp(sample->name, img->name) != 0;
+	}
+
+	/* the same program was executed again, or the process renamed
+	 * itself */
+	img->text = sample->text;
+	memcpy(img->name, sample->name, PNAME_LEN);
+
+	return img->execd;
+}
+
+
+void execwatch_stop (void)
+{
+	if (cn_sock != -1) {
+		cn_send(PROC_CN_MCAST_IGNORE);
+		close(cn_sock);
+		cn_sock = -1;
+	}
+
+	free(images);
+	images = NULL;
+	nimages = 0;
+}
@@ -0,0 +1,32 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Detecting processes which exec a different program. The executable
+ * (device and inode of /proc/PID/exe, or the name if exe can't be read) is
+ * captured at start and compared again only after an exec event from the
+ * kernel's process event connector. Without the connector, and when events
+ * were lost, it is compared when the name or the size of the program text
+ * in the stat file have changed. */
+
+#ifndef PW_EXECWATCH_H
+#define PW_EXECWATCH_H
+
+#include <stdbool.h>
+
+#include "proc.h"
+
+/* subscribe to exec events and capture the programs of the processes on
+ * proclist */
+int execwatch_start (const struct proclist * proclist);
+
+/* read the exec events since the previous call */
+void execwatch_tick (void);
+
+/* check if p has executed a different program, given its latest sample */
+bool execwatch_check (const struct proc * const p,
+		      const struct proc * const sample);
+
+/* unsubscribe from exec events */
+void execwatch_stop (void);
+
+#endif /* PW_EXECWATCH_H */
@@ -0,0 +1,235 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "fdscan.h"
+#include "procfs.h"
+#include "stats.h"
+
+/* processes per thread below which more threads aren't worth starting */
+#define FDSCAN_MIN_PER_THREAD 256
+
+/* links in /proc/PID which keep a file busy like an open descriptor */
+static const char * const busy_links[] = { "cwd", "root", "exe" };
+
+struct fdscan_job {
+	const unsigned *pids;
+	size_t n;
+	const struct fdset *set;
+	unsigned *holders;
+	size_t nholders;
+	size_t nunknown;
+};
+
+
+static int cmp_fdkey (const void *a, const void *b)
+{
+	const struct fdkey *x = a, *y = b;
+
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+
+static int cmp_dev (const void *a, const void *b)
+{
+	const dev_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+
+static bool fdset_has (const struct fdset * const set,
+		       const struct stat * const st)
+{
+	struct fdkey key;
+
+	if (set->ndevs > 0 && bsearch(&st->st_dev, set->devs, set->ndevs,
+				      sizeof(*set->devs), cmp_dev) != NULL)
+		return true;
+
+	if (set->sockets) {
+		if (!S_ISSOCK(st->st_mode))
+			return false;
+		key.dev = 0;
+	} else {
+		key.dev = st->st_dev;
+	}
+	key.ino = st->st_ino;
+
+	return bsearch(&key, set->keys, set->n, sizeof(key),
+		       cmp_fdkey) != NULL;
+}
+
+
+static void * fdscan_thread (void *arg)
+{
+	struct fdscan_job *job = arg;
+
+	for (size_t i = 0; i < job->n; ++i) {
+		switch (fdscan_pid(job->pids[i], job->set)) {
+		case FDSCAN_HOLDS:
+			job->holders[job->nholders++] = job->pids[i];
+			break;
+		case FDSCAN_UNKNOWN:
+			++job->nunknown;
+			break;
+		case FDSCAN_CLEAR:
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+void fdset_sort (struct fdset * restrict set)
+{
+	if (set->sockets) {
+		for (size_t i = 0; i < set->n; ++i)
+			set->keys[i].dev = 0;
+	}
+	qsort(set->keys, set->n, sizeof(*set->keys), cmp_fdkey);
+	qsort(set->devs, set->ndevs, sizeof(*set->devs), cmp_dev);
+}
+
+
+enum FDSCAN_RESULT fdscan_pid (const unsigned pid,
+			       const struct fdset * const set)
+{
+	char path[PROCFS_PATH_LEN];
+	struct dirent *de;
+	bool found = false;
+	DIR *dir;
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "%u/fd", pid) != E_SUCCESS)
+		return FDSCAN_UNKNOWN;
+
+	/* processes of other users can't be scanned without privileges, and
+	 * neither can their links below */
+	dir = opendir(path);
+	stats_count(SC_OPENS, 1);
+	if (dir == NULL)
+		return errno == ENOENT || errno == ESRCH ? FDSCAN_CLEAR :
+		       FDSCAN_UNKNOWN;
+
+	while (!found && (de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (de->d_name[0] == '.')
+			continue;
+		if (fstatat(dirfd(dir), de->d_name, &st, 0) == 0)
+			found = fdset_has(set, &st);
+	}
+
+	closedir(dir);
+
+	for (size_t i = 0; !found && !set->sockets &&
+	     i < sizeof(busy_links) / sizeof(*busy_links); ++i) {
+		struct stat st;
+
+		if (procfs_path(path, PROCFS_PATH_LEN, "%u/%s", pid,
+				busy_links[i]) == E_SUCCESS &&
+		    stat(path, &st) == 0)
+			found = fdset_has(set, &st);
+	}
+
+	return found ? FDSCAN_HOLDS : FDSCAN_CLEAR;
+}
+
+
+unsigned fdscan_threads (void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpu < 1)
+		ncpu = 1;
+	if (ncpu > FDSCAN_MAX_THREADS)
+		ncpu = FDSCAN_MAX_THREADS;
+
+	return (unsigned) ncpu;
+}
+
+
+size_t fdscan_pids (const unsigned * const pids, const size_t n,
+		    const struct fdset * const set, unsigned * holders,
+		    size_t * restrict nunknown, unsigned nthreads)
+{
+	struct fdscan_job *jobs;
+	pthread_t *threads;
+	size_t nholders = 0, unknown = 0;
+
+	if (nthreads > n / FDSCAN_MIN_PER_THREAD)
+		nthreads = (unsigned) (n / FDSCAN_MIN_PER_THREAD);
+	if (nthreads == 0)
+		nthreads = 1;
+
+	jobs = calloc(nthreads, sizeof(*jobs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (jobs == NULL || threads == NULL) {
+		free(jobs);
+		free(threads);
+		nthreads = 1;
+		jobs = NULL;
+	}
+
+	if (nthreads == 1) {
+		struct fdscan_job job = { pids, n, set, holders, 0, 0 };
+
+		fdscan_thread(&job);
+		free(jobs);
+		free(threads);
+		if (nunknown != NULL)
+			*nunknown = job.nunknown;
+		return job.nholders;
+	}
+
+	/* each thread gets a slice of pids and of holders */
+	for (unsigned t = 0; t < nthreads; ++t) {
+		size_t first = n * t / nthreads;
+		size_t last = n * (t + 1) / nthreads;
+
+		jobs[t].pids = pids + first;
+		jobs[t].n = last - first;
+		jobs[t].set = set;
+		jobs[t].holders = holders + first;
+		jobs[t].nholders = 0;
+		jobs[t].nunknown = 0;
+
+		/* fall back to scanning in this thread */
+		if (pthread_create(&threads[t], NULL, fdscan_thread,
+				   &jobs[t]) != 0) {
+			fdscan_thread(&jobs[t]);
+			threads[t] = pthread_self();
+		}
+	}
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		if (!pthread_equal(threads[t], pthread_self()))
+			pthread_join(threads[t], NULL);
+
+		memmove(holders + nholders, jobs[t].holders,
+			jobs[t].nholders * sizeof(*holders));
+		nholders += jobs[t].nholders;
+		unknown += jobs[t].nunknown;
+	}
+
+	free(jobs);
+	free(threads);
+	if (nunknown != NULL)
+		*nunknown = unknown;
+	return nholders;
+}
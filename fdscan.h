@@ -0,0 +1,62 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Scanning of open file descriptors in /proc/PID/fd, and of the working and
+ * root directories and the executable of processes, which keep files busy
+ * the same way. Files are matched by the device and inode they refer to,
+ * never by path, or by the device alone for whole file systems. */
+
+#ifndef PW_FDSCAN_H
+#define PW_FDSCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* upper limit for scanner threads */
+#define FDSCAN_MAX_THREADS 16
+
+struct fdkey {
+	dev_t dev;
+	ino_t ino;
+};
+
+/* set of files to look for. If sockets is set, keys are socket inodes and
+ * their dev is ignored */
+struct fdset {
+	struct fdkey *keys;	/* sorted with fdset_sort() */
+	size_t n;
+	bool sockets;
+	dev_t *devs;		/* file systems any file of which matches */
+	size_t ndevs;
+};
+
+/* results of fdscan_pid() */
+enum FDSCAN_RESULT {
+	FDSCAN_CLEAR,		/* no file in the set is open, or the process
+				 * is gone */
+	FDSCAN_HOLDS,		/* a file in the set is open */
+	FDSCAN_UNKNOWN		/* the fds can't be read, e.g. of a process of
+				 * another user */
+};
+
+/* sort the keys and devices of set for lookups */
+void fdset_sort (struct fdset * restrict set);
+
+/* check if process pid has a file in set open */
+enum FDSCAN_RESULT fdscan_pid (const unsigned pid,
+			       const struct fdset * const set);
+
+/* number of threads worth scanning with: one per online CPU, limited to
+ * FDSCAN_MAX_THREADS */
+unsigned fdscan_threads (void);
+
+/* scan the processes in pids with up to nthreads threads. The PIDs of the
+ * processes having a file in set open are put to holders, which must have
+ * room for n PIDs. If nunknown is not NULL, it is set to the number of
+ * processes whose fds couldn't be read. Returns the number of holders */
+size_t fdscan_pids (const unsigned * const pids, const size_t n,
+		    const struct fdset * const set, unsigned * holders,
+		    size_t * restrict nunknown, unsigned nthreads);
+
+#endif /* PW_FDSCAN_H */
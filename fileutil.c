@@ -9,8 +9,16 @@
 
 #include "error.h"
 #include "fileutil.h"
+#include "procfs.h"
+#include "stats.h"
 
-#define STAT_PATH_LEN 32
+
+static int cmp_uint (const void *a, const void *b)
+{
+	const unsigned *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
 
 
 static bool is_numeric (const char *str)
@@ -37,8 +45,9 @@ void filter_numeric_dirs (struct filelist * filelist)
 	char *str;
 
 	SLIST_FOREACH_SAFE(fp, filelist, files, fp_tmp) {
-		/* skip "/proc/" */
-		str = fp->path + 6;
+		/* skip the proc root */
+		str = strrchr(fp->path, '/');
+		str = str == NULL ? fp->path : str + 1;
 		if (!is_numeric(str)) {
 			SLIST_REMOVE(filelist, fp, file, files);
 			file_destroy(fp);
@@ -52,14 +61,15 @@ void filter_numeric_dirs (struct filelist * filelist)
 int find_pid (struct filelist * filelist, const char * pname,
 	      struct proclist * proclist)
 {
-	struct proc proc, *proc_tmp;
+	struct proc proc = { .pid = 0 }, *proc_tmp;
 	struct file *fp;
-	char stat_path[STAT_PATH_LEN];
+	char stat_path[PROCFS_PATH_LEN];
 	int cnt = 0;
 
 	SLIST_FOREACH(fp, filelist, files) {
-		snprintf(stat_path, STAT_PATH_LEN, "%s/stat", fp->path);
-		parse_stat_file(stat_path, &proc);
+		snprintf(stat_path, PROCFS_PATH_LEN, "%s/stat", fp->path);
+		if (parse_stat_file(stat_path, &proc) != E_SUCCESS)
+			continue;
 		if (!strcmp(pname, proc.name)) {
 			proc_tmp = malloc(sizeof(struct proc));
 			*proc_tmp = proc;
@@ -78,6 +88,7 @@ int get_dir_contents (const char * dirpath, struct filelist * filelist)
 	DIR * dir = opendir(dirpath);
 	struct dirent *de;
 
+	stats_count(SC_OPENS, 1);
 	if (dir == NULL) {
 		return E_FAIL;
 	}
@@ -101,7 +112,8 @@ int get_dir_dirs (const char * dirpath, struct filelist * filelist)
 {
 	struct filelist tmp_list;
 	SLIST_INIT(&tmp_list);
-	get_dir_contents(dirpath, &tmp_list);
+	if (get_dir_contents(dirpath, &tmp_list) != E_SUCCESS)
+		return E_FAIL;
 
 	struct file *f;
 	while ((f = SLIST_FIRST(&tmp_list)) != NULL) {
@@ -120,7 +132,48 @@ int get_dir_dirs (const char * dirpath, struct filelist * filelist)
 
 int get_proc_dirs (struct filelist * fl)
 {
-	get_dir_dirs("/proc", fl);
+	if (get_dir_dirs(procfs_root(), fl) != E_SUCCESS)
+		return E_FAIL;
 	filter_numeric_dirs(fl);
 	return E_SUCCESS;
 }
+
+
+int get_proc_pids (unsigned ** pids, size_t * n)
+{
+	DIR *dir = opendir(procfs_root());
+	struct dirent *de;
+	size_t cap = 1024;
+	unsigned *arr;
+
+	stats_count(SC_OPENS, 1);
+	if (dir == NULL)
+		return E_FAIL;
+
+	arr = malloc(cap * sizeof(*arr));
+	*n = 0;
+	while (arr != NULL && (de = readdir(dir)) != NULL) {
+		if (de->d_type != DT_DIR || !is_numeric(de->d_name))
+			continue;
+
+		if (*n == cap) {
+			unsigned *tmp = realloc(arr, 2 * cap * sizeof(*arr));
+			if (tmp == NULL) {
+				free(arr);
+				arr = NULL;
+				break;
+			}
+			arr = tmp;
+			cap *= 2;
+		}
+		arr[(*n)++] = (unsigned) strtoul(de->d_name, NULL, 10);
+	}
+	closedir(dir);
+
+	if (arr == NULL)
+		return E_FAIL;
+
+	qsort(arr, *n, sizeof(*arr), cmp_uint);
+	*pids = arr;
+	return E_SUCCESS;
+}
@@ -4,6 +4,8 @@
 #ifndef PW_FILEUTIL_H
 #define PW_FILEUTIL_H
 
+#include <stddef.h>
+
 #include "proc.h"
 #include "queue.h"
 
@@ -18,7 +20,7 @@ SLIST_HEAD(filelist, file);
 /* deep free struct file */
 void file_destroy (struct file * f);
 
-/* filter out and free all non-numeric /proc -dirs */
+/* filter out and free all non-numeric proc root -dirs */
 void filter_numeric_dirs (struct filelist * filelist);
 
 /* find PIDs for process pname from filelist, and put the matching processes in
@@ -32,7 +34,11 @@ int get_dir_contents (const char * dirpath, struct filelist * filelist);
 /* get directies in a directory */
 int get_dir_dirs (const char * dirpath, struct filelist * filelist);
 
-/* get only numeric directories inside /proc */
+/* get only numeric directories inside the proc root */
 int get_proc_dirs (struct filelist * fl);
 
+/* get the PIDs of all processes in the proc root as a sorted array. The
+ * array is allocated to *pids and must be freed by the caller */
+int get_proc_pids (unsigned ** pids, size_t * n);
+
 #endif /* PW_FILEUTIL_H */
@@ -0,0 +1,243 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "fdscan.h"
+#include "fileutil.h"
+#include "filewait.h"
+#include "go.h"
+#include "proc.h"
+#include "queue.h"
+
+static struct fdset set = { NULL, 0, false, NULL, 0 };
+static const char *label = NULL;	/* path, if there is only one */
+static struct proclist holders = SLIST_HEAD_INITIALIZER(holders);
+
+/* sorted PIDs of the processes that existed on the previous round */
+static unsigned *seen = NULL;
+static size_t nseen = 0;
+
+/* the unreadable processes were warned about */
+static bool unknown_warned = false;
+
+
+static const char * files_str (void)
+{
+	return set.n + set.ndevs == 1 ? label : "the files";
+}
+
+
+static void report_closed (void)
+{
+	go(GO_MESS, "No process has %s open\n", files_str());
+	go_event_begin(GO_MESS, "closed");
+	go_event_end();
+}
+
+
+/* processes whose fds can't be read may hold the files unnoticed */
+static void warn_unknown (const size_t nunknown)
+{
+	if (nunknown == 0 || unknown_warned)
+		return;
+
+	go(GO_WARN, "Could not read the open files of %zu processes, which "
+		    "may also have %s open\n", nunknown, files_str());
+	unknown_warned = true;
+}
+
+
+/* start tracking pid as a holder */
+static void add_holder (const unsigned pid)
+{
+	struct proc *proc = malloc(sizeof(struct proc));
+
+	if (proc == NULL)
+		return;
+
+	if (parse_stat_pid(pid, proc) != E_SUCCESS) {
+		free(proc);
+		return;
+	}
+
+	go(GO_MESS, "Waiting for PID %u (%s) to close %s\n", proc->pid,
+	   proc->name, files_str());
+	go_event_begin(GO_MESS, "holding");
+	go_event_uint("pid", proc->pid);
+	go_event_str("name", proc->name);
+	go_event_uint("t0", proc->t0);
+	go_event_end();
+
+	SLIST_INSERT_HEAD(&holders, proc, procs);
+}
+
+
+/* check if path, which is st, is the root of a mounted file system */
+static bool is_mount_point (const char * const path,
+			    const struct stat * const st)
+{
+	char parent[PATH_MAX];
+	struct stat pst;
+
+	if (!S_ISDIR(st->st_mode) ||
+	    snprintf(parent, PATH_MAX, "%s/..", path) >= PATH_MAX ||
+	    stat(parent, &pst) == -1)
+		return false;
+
+	/* the parent of / is / itself */
+	return pst.st_dev != st->st_dev || pst.st_ino == st->st_ino;
+}
+
+
+int filewait_add (const char * const path)
+{
+	struct stat st;
+	struct fdkey *keys;
+
+	if (stat(path, &st) == -1) {
+		go(GO_ERR, "Could not stat '%s': %s\n", path, strerror(errno));
+		return E_FAIL;
+	}
+
+	/* a mount point is busy while any file in the file system is */
+	if (is_mount_point(path, &st)) {
+		dev_t *devs = realloc(set.devs,
+				      (set.ndevs + 1) * sizeof(*devs));
+
+		if (devs == NULL)
+			return E_FAIL;
+		devs[set.ndevs++] = st.st_dev;
+		set.devs = devs;
+		label = path;
+		return E_SUCCESS;
+	}
+
+	keys = realloc(set.keys, (set.n + 1) * sizeof(*keys));
+	if (keys == NULL)
+		return E_FAIL;
+
+	keys[set.n].dev = st.st_dev;
+	keys[set.n].ino = st.st_ino;
+	set.keys = keys;
+	++set.n;
+	label = path;
+
+	return E_SUCCESS;
+}
+
+
+bool filewait_active (void)
+{
+	return set.n > 0 || set.ndevs > 0;
+}
+
+
+int filewait_start (void)
+{
+	unsigned *found;
+	size_t nfound, nunknown;
+
+	if (!filewait_active())
+		return E_SUCCESS;
+
+	fdset_sort(&set);
+
+	if (get_proc_pids(&seen, &nseen) != E_SUCCESS) {
+		go(GO_ERR, "Could not list processes\n");
+		return E_FAIL;
+	}
+
+	found = malloc((nseen ? nseen : 1) * sizeof(*found));
+	if (found == NULL)
+		return E_FAIL;
+
+	nfound = fdscan_pids(seen, nseen, &set, found, &nunknown,
+			     fdscan_threads());
+	for (size_t i = 0; i < nfound; ++i)
+		add_holder(found[i]);
+	free(found);
+	warn_unknown(nunknown);
+
+	if (SLIST_EMPTY(&holders))
+		report_closed();
+
+	return E_SUCCESS;
+}
+
+
+void filewait_tick (void)
+{
+	struct proc *proc, *tmp_proc;
+	unsigned *pids;
+	size_t npids, j = 0, nunknown = 0;
+
+	if (!filewait_active())
+		return;
+
+	/* recheck the known holders */
+	SLIST_FOREACH_SAFE(proc, &holders, procs, tmp_proc) {
+		struct proc tmp = { .pid = 0 };
+
+		if (parse_stat_pid(proc->pid, &tmp) != E_SUCCESS ||
+		    !proc_eq(proc, &tmp)) {
+			SLIST_REMOVE(&holders, proc, proc, procs);
+			proc_report(proc);
+			free(proc);
+		} else if (fdscan_pid(proc->pid, &set) == FDSCAN_CLEAR) {
+			SLIST_REMOVE(&holders, proc, proc, procs);
+			go(GO_MESS, "Process %u %s closed %s\n", proc->pid,
+			   proc->name, files_str());
+			go_event_begin(GO_MESS, "released");
+			go_event_uint("pid", proc->pid);
+			go_event_str("name", proc->name);
+			go_event_end();
+			free(proc);
+		} else {
+			proc_add_sample(proc, &tmp);
+		}
+	}
+
+	/* scan the processes that weren't there on the previous round. New
+	 * holders are most likely children of holders */
+	if (get_proc_pids(&pids, &npids) != E_SUCCESS)
+		return;
+
+	for (size_t i = 0; i < npids; ++i) {
+		while (j < nseen && seen[j] < pids[i])
+			++j;
+		if (j < nseen && seen[j] == pids[i])
+			continue;
+
+		switch (fdscan_pid(pids[i], &set)) {
+		case FDSCAN_HOLDS:
+			add_holder(pids[i]);
+			break;
+		case FDSCAN_UNKNOWN:
+			++nunknown;
+			break;
+		case FDSCAN_CLEAR:
+			break;
+		}
+	}
+	warn_unknown(nunknown);
+
+	free(seen);
+	seen = pids;
+	nseen = npids;
+
+	if (SLIST_EMPTY(&holders))
+		report_closed();
+}
+
+
+bool filewait_done (void)
+{
+	return SLIST_EMPTY(&holders);
+}
@@ -0,0 +1,29 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Waiting until no process has a file open. The processes having any of the
+ * files open (holders) are found with one scan of every process' open file
+ * descriptors. After that only the holders and processes that did not exist
+ * on the previous round are scanned. */
+
+#ifndef PW_FILEWAIT_H
+#define PW_FILEWAIT_H
+
+#include <stdbool.h>
+
+/* add a file to wait for */
+int filewait_add (const char * const path);
+
+/* check if any files were added */
+bool filewait_active (void);
+
+/* find the processes having the files open */
+int filewait_start (void);
+
+/* check the holders and new processes */
+void filewait_tick (void);
+
+/* check if no process has the files open anymore */
+bool filewait_done (void);
+
+#endif /* PW_FILEWAIT_H */
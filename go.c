@@ -3,11 +3,124 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "go.h"
 
+/* stdout buffer size in GO_JSON format. Events are flushed with go_flush()
+ * once per pass of the wait loop, so a burst of events costs a few writes */
+#define GO_BUF_LEN 65536
+
+/* maximum length of a warning or error message in GO_JSON format */
+#define GO_MSG_LEN 512
+
 static enum GO_PRINT_LVL go_lvl = GO_NORMAL;
+static enum GO_FORMAT go_fmt = GO_TEXT;
+
+/* is the current event printed */
+static bool ev_print = false;
+
+
+static bool lvl_printed (const enum GO_LVL lvl)
+{
+	switch (lvl) {
+	case GO_INFO:
+		return go_lvl == GO_VERBOSE;
+	case GO_MESS:
+		return go_lvl >= GO_NORMAL;
+	case GO_WARN:
+		return go_lvl > GO_QUIET;
+	case GO_ESS:
+	case GO_ERR:
+	default:
+		return true;
+	}
+}
+
+
+/* print a JSON string literal */
+/* length of the valid UTF-8 sequence of 2 to 4 bytes at s, 0 if there is
+ * none */
+static size_t utf8_len (const unsigned char * const s)
+{
+	size_t len;
+	uint32_t cp;
+
+	if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+		len = 2;
+		cp = s[0] & 0x1f;
+	} else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+		len = 3;
+		cp = s[0] & 0x0f;
+	} else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+		len = 4;
+		cp = s[0] & 0x07;
+	} else {
+		return 0;
+	}
+
+	for (size_t i = 1; i < len; ++i) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		cp = cp << 6 | (s[i] & 0x3f);
+	}
+
+	/* overlong forms, surrogates and code points past U+10FFFF */
+	if ((len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000) ||
+	    (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+		return 0;
+
+	return len;
+}
+
+
+/* Print str as a JSON string. Names may be cut in the middle of a UTF-8
+ * sequence by the kernel, so bytes not part of a valid sequence are
+ * replaced with U+FFFD to keep the output valid */
+static void print_json_str (const char * str)
+{
+	const unsigned char *s = (const unsigned char *) str;
+
+	putchar('"');
+	while (*s != '\0') {
+		size_t len;
+
+		if (*s == '"' || *s == '\\') {
+			printf("\\%c", *s++);
+		} else if (*s < 0x20) {
+			printf("\\u%04x", *s++);
+		} else if (*s < 0x80) {
+			putchar(*s++);
+		} else if ((len = utf8_len(s)) > 0) {
+			fwrite(s, 1, len, stdout);
+			s += len;
+		} else {
+			fputs("\\ufffd", stdout);
+			++s;
+		}
+	}
+	putchar('"');
+}
+
+
+/* print a warning or error as an event */
+static void go_json_msg (const enum GO_LVL lvl, const char *fmt, va_list ap)
+{
+	char msg[GO_MSG_LEN];
+	size_t len;
+
+	vsnprintf(msg, GO_MSG_LEN, fmt, ap);
+	len = strlen(msg);
+	if (len > 0 && msg[len-1] == '\n')
+		msg[len-1] = '\0';
+
+	go_event_begin(lvl, lvl == GO_ERR ? "error" : "warning");
+	go_event_str("message", msg);
+	go_event_end();
+}
 
 
 void go (const enum GO_LVL lvl, const char *fmt, ...)
@@ -15,6 +128,16 @@ void go (const enum GO_LVL lvl, const char *fmt, ...)
 	bool print = false;
 	FILE *os = stdout;
 
+	if (go_fmt == GO_JSON && lvl != GO_ESS) {
+		if (lvl == GO_WARN || lvl == GO_ERR) {
+			va_list ap;
+			va_start(ap, fmt);
+			go_json_msg(lvl, fmt, ap);
+			va_end(ap);
+		}
+		return;
+	}
+
 	switch (lvl) {
 	case GO_INFO:
 		if (go_lvl == GO_VERBOSE) {
@@ -68,3 +191,88 @@ void go_set_lvl (const enum GO_PRINT_LVL lvl)
 {
 	go_lvl = lvl;
 }
+
+
+void go_set_format (const enum GO_FORMAT fmt)
+{
+	go_fmt = fmt;
+
+	if (fmt == GO_JSON)
+		setvbuf(stdout, NULL, _IOFBF, GO_BUF_LEN);
+}
+
+
+enum GO_FORMAT go_format (void)
+{
+	return go_fmt;
+}
+
+
+void go_event_begin (const enum GO_LVL lvl, const char * const name)
+{
+	struct timespec wall, mono;
+
+	ev_print = go_fmt == GO_JSON && lvl_printed(lvl);
+	if (!ev_print)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &wall);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+
+	printf("{\"event\":\"%s\",\"time_ns\":%llu,\"mono_ns\":%llu", name,
+	       (unsigned long long) wall.tv_sec * 1000000000 +
+	       (unsigned long long) wall.tv_nsec,
+	       (unsigned long long) mono.tv_sec * 1000000000 +
+	       (unsigned long long) mono.tv_nsec);
+}
+
+
+void go_event_str (const char * const key, const char * const val)
+{
+	if (!ev_print)
+		return;
+
+	printf(",\"%s\":", key);
+	print_json_str(val);
+}
+
+
+void go_event_uint (const char * const key, const uint64_t val)
+{
+	if (ev_print)
+		printf(",\"%s\":%llu", key, (unsigned long long) val);
+}
+
+
+void go_event_num (const char * const key, const double val)
+{
+	if (ev_print)
+		printf(",\"%s\":%.6f", key, val);
+}
+
+
+void go_event_uints (const char * const key, const uint64_t * const vals,
+		     const unsigned n)
+{
+	if (!ev_print)
+		return;
+
+	printf(",\"%s\":[", key);
+	for (unsigned i = 0; i < n; ++i)
+		printf(i ? ",%llu" : "%llu", (unsigned long long) vals[i]);
+	putchar(']');
+}
+
+
+void go_event_end (void)
+{
+	if (ev_print)
+		fputs("}\n", stdout);
+	ev_print = false;
+}
+
+
+void go_flush (void)
+{
+	fflush(stdout);
+}
@@ -5,6 +5,11 @@
  * go() as go can then decide what to do to messages based on their GO_LVL and
  * current GO_PRINT_LVL */
 
+#ifndef PW_GO_H
+#define PW_GO_H
+
+#include <stdint.h>
+
 enum GO_LVL {
 	GO_INFO,
 	GO_MESS,
@@ -19,9 +24,43 @@ enum GO_PRINT_LVL {
 	GO_VERBOSE
 };
 
+/* Output formats. In GO_JSON format free text GO_INFO and GO_MESS messages
+ * are dropped in favour of events, and warnings and errors are printed as
+ * events to stdout. Each event is a JSON object on a line of its own. */
+enum GO_FORMAT {
+	GO_TEXT,
+	GO_JSON
+};
+
 
 /* output messages if GO_LVL is high enough compared to current GO_PRINT_LVL */
 void go (const enum GO_LVL lvl, const char *fmt, ...);
 
 /* set GO_PRINT_LVL */
 void go_set_lvl (const enum GO_PRINT_LVL lvl);
+
+/* set output format. Must be called before anything is printed */
+void go_set_format (const enum GO_FORMAT fmt);
+
+/* get output format */
+enum GO_FORMAT go_format (void);
+
+/* start an event called name. The event is printed only if lvl is high
+ * enough, else the go_event_* calls up to go_event_end() do nothing. In
+ * GO_TEXT format events are not printed at all */
+void go_event_begin (const enum GO_LVL lvl, const char * const name);
+
+/* add fields to the current event */
+void go_event_str (const char * const key, const char * const val);
+void go_event_uint (const char * const key, const uint64_t val);
+void go_event_num (const char * const key, const double val);
+void go_event_uints (const char * const key, const uint64_t * const vals,
+		     const unsigned n);
+
+/* finish the current event */
+void go_event_end (void);
+
+/* write out buffered output */
+void go_flush (void);
+
+#endif /* PW_GO_H */
@@ -0,0 +1,319 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "go.h"
+#include "group.h"
+#include "strutil.h"
+
+struct group {
+	char *name;
+	char *members;		/* comma separated, resolved on start */
+	const char *cmd;	/* points into name, NULL if none */
+	unsigned left;		/* members still on proclist */
+	unsigned size;		/* members at start */
+	pid_t cmd_pid;		/* running command, 0 if none */
+};
+
+/* a process in one or more groups */
+struct member {
+	unsigned pid;
+	uint64_t groups;	/* bit i is set for a member of group i */
+};
+
+static struct group *groups = NULL;
+static unsigned ngroups = 0;
+
+/* sorted by pid once the groups are resolved */
+static struct member *mems = NULL;
+static size_t nmems = 0;
+static size_t mems_cap = 0;
+
+
+static int cmp_member (const void *a, const void *b)
+{
+	unsigned pa = ((const struct member *) a)->pid;
+	unsigned pb = ((const struct member *) b)->pid;
+
+	return (pa > pb) - (pa < pb);
+}
+
+
+static void report_done (const struct group * const g)
+{
+	go(GO_MESS, "Group %s done (%u processes)\n", g->name, g->size);
+	go_event_begin(GO_MESS, "group-done");
+	go_event_str("group", g->name);
+	go_event_uint("members", g->size);
+	go_event_end();
+}
+
+
+/* run the command of g without waiting for it */
+static void run_cmd (struct group * const g)
+{
+	pid_t pid;
+
+	if (g->cmd == NULL)
+		return;
+
+	/* the output of the command must not mix with unflushed events */
+	go_flush();
+
+	pid = fork();
+	if (pid == -1) {
+		go(GO_WARN, "Could not run the command of group %s: %s\n",
+		   g->name, strerror(errno));
+		return;
+	} else if (pid == 0) {
+		setenv("PROCWAIT_GROUP", g->name, 1);
+		execl("/bin/sh", "sh", "-c", g->cmd, (char *) NULL);
+		_exit(127);
+	}
+
+	g->cmd_pid = pid;
+}
+
+
+static void complete (struct group * const g)
+{
+	report_done(g);
+	run_cmd(g);
+}
+
+
+/* add proc to group idx. The members are merged once all are added, and
+ * the entries of a process on proclist after all options are parsed */
+static int add_member (struct proclist * restrict proclist,
+		       struct proc * restrict proc, const unsigned idx)
+{
+	if (nmems == mems_cap) {
+		size_t cap = mems_cap ? 2 * mems_cap : 64;
+		struct member *tmp = realloc(mems, cap * sizeof(*mems));
+
+		if (tmp == NULL) {
+			free(proc);
+			go(GO_ERR, "Could not allocate memory for group "
+				   "members\n");
+			return E_FAIL;
+		}
+		mems = tmp;
+		mems_cap = cap;
+	}
+	mems[nmems].pid = proc->pid;
+	mems[nmems].groups = (uint64_t) 1 << idx;
+	++nmems;
+	SLIST_INSERT_HEAD(proclist, proc, procs);
+
+	return E_SUCCESS;
+}
+
+
+static int resolve_member (struct filelist * fl, const char * const member,
+			   struct proclist * restrict proclist,
+			   const unsigned idx)
+{
+	struct proclist found;
+	struct proc *proc;
+	unsigned pid;
+	int retval = E_SUCCESS;
+
+	if (!strncmp(member, "n=", 2)) {
+		SLIST_INIT(&found);
+		if (find_pid(fl, member + 2, &found) == 0)
+			go(GO_ERR, "No process called '%s' was found.\n",
+			   member + 2);
+
+		while (!SLIST_EMPTY(&found)) {
+			proc = SLIST_FIRST(&found);
+			SLIST_REMOVE_HEAD(&found, procs);
+			if (retval == E_SUCCESS)
+				retval = add_member(proclist, proc, idx);
+			else
+				free(proc);
+		}
+		return retval;
+	}
+
+	if (strtou(member, &pid) != E_SUCCESS) {
+		go(GO_ERR, "Invalid PID '%s' in group %s\n", member,
+		   groups[idx].name);
+		return E_INVAL;
+	}
+
+	proc = malloc(sizeof(struct proc));
+	if (proc == NULL) {
+		go(GO_ERR, "Could not allocate memory for struct proc\n");
+		return E_FAIL;
+	}
+	proc->pid = pid;
+	proc->tgid = 0;
+
+	return add_member(proclist, proc, idx);
+}
+
+
+int group_add (const char * const spec)
+{
+	struct group *tmp, *g;
+	char *members, *cmd;
+
+	if (ngroups == GROUP_MAX) {
+		go(GO_ERR, "Too many groups\n");
+		return E_FAIL;
+	}
+
+	tmp = realloc(groups, (ngroups + 1) * sizeof(*groups));
+	if (tmp == NULL)
+		return E_FAIL;
+	groups = tmp;
+	g = &groups[ngroups];
+
+	g->name = strdup(spec);
+	if (g->name == NULL)
+		return E_FAIL;
+
+	members = strchr(g->name, ':');
+	if (members == NULL || members == g->name || members[1] == '\0') {
+		free(g->name);
+		return E_INVAL;
+	}
+	*members++ = '\0';
+
+	/* the command may contain ':' */
+	cmd = strchr(members, ':');
+	if (cmd != NULL)
+		*cmd++ = '\0';
+
+	/* NAME::COMMAND would complete at once and run the command */
+	if (members[strspn(members, ",")] == '\0') {
+		go(GO_ERR, "Group %s has no members\n", g->name);
+		free(g->name);
+		return E_INVAL;
+	}
+
+	g->members = members;
+	g->cmd = cmd != NULL && *cmd != '\0' ? cmd : NULL;
+	g->left = 0;
+	g->size = 0;
+	g->cmd_pid = 0;
+	++ngroups;
+
+	return E_SUCCESS;
+}
+
+
+bool group_active (void)
+{
+	return ngroups > 0;
+}
+
+
+bool group_has_names (void)
+{
+	for (unsigned i = 0; i < ngroups; ++i) {
+		const char *m = groups[i].members;
+
+		if (!strncmp(m, "n=", 2) || strstr(m, ",n=") != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+
+int group_resolve (struct filelist * fl, struct proclist * restrict proclist)
+{
+	int retval = E_SUCCESS;
+	size_t n = 0;
+
+	for (unsigned i = 0; i < ngroups && retval == E_SUCCESS; ++i) {
+		char *member, *save = NULL;
+
+		for (member = strtok_r(groups[i].members, ",", &save);
+		     member != NULL && retval == E_SUCCESS;
+		     member = strtok_r(NULL, ",", &save))
+			retval = resolve_member(fl, member, proclist, i);
+	}
+
+	/* a process listed many times is one member of each of its groups */
+	qsort(mems, nmems, sizeof(*mems), cmp_member);
+	for (size_t i = 0, j; i < nmems; i = j) {
+		uint64_t bits = mems[i].groups;
+
+		for (j = i + 1; j < nmems && mems[j].pid == mems[i].pid; ++j)
+			bits |= mems[j].groups;
+		mems[n].pid = mems[i].pid;
+		mems[n].groups = bits;
+		++n;
+
+		for (unsigned k = 0; k < ngroups; ++k) {
+			if (bits & ((uint64_t) 1 << k)) {
+				++groups[k].left;
+				++groups[k].size;
+			}
+		}
+	}
+	nmems = n;
+
+	return retval;
+}
+
+
+void group_start (void)
+{
+	for (unsigned i = 0; i < ngroups; ++i) {
+		if (groups[i].size == 0)
+			complete(&groups[i]);
+	}
+}
+
+
+void group_proc_done (const struct proc * const p)
+{
+	struct member key = { .pid = p->pid }, *m;
+
+	/* threads are not group members */
+	if (p->tgid != 0)
+		return;
+
+	m = bsearch(&key, mems, nmems, sizeof(*mems), cmp_member);
+	if (m == NULL)
+		return;
+
+	for (unsigned i = 0; i < ngroups; ++i) {
+		if ((m->groups & ((uint64_t) 1 << i)) && --groups[i].left == 0)
+			complete(&groups[i]);
+	}
+	m->groups = 0;
+}
+
+
+void group_reap (const bool block)
+{
+	for (unsigned i = 0; i < ngroups; ++i) {
+		struct group *g = &groups[i];
+		int status;
+
+		if (g->cmd_pid == 0 ||
+		    waitpid(g->cmd_pid, &status, block ? 0 : WNOHANG) <= 0)
+			continue;
+
+		g->cmd_pid = 0;
+		status = WIFEXITED(status) ? WEXITSTATUS(status) :
+			 128 + WTERMSIG(status);
+		go(GO_INFO, "Command of group %s exited with status %d\n",
+		   g->name, status);
+		go_event_begin(GO_MESS, "group-command");
+		go_event_str("group", g->name);
+		go_event_uint("status", (uint64_t) status);
+		go_event_end();
+	}
+}
@@ -0,0 +1,45 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Wait groups. The members of all groups are tracked on the same proclist
+ * as the other processes, so a single sweep checks every group and a process
+ * in many groups is checked once. The groups of each member are kept in a
+ * table of their own, a bit for each group. A group completes when its last
+ * member is dropped from the list, and may then run a command. */
+
+#ifndef PW_GROUP_H
+#define PW_GROUP_H
+
+#include <stdbool.h>
+
+#include "fileutil.h"
+#include "proc.h"
+
+/* maximum number of groups, one bit each in a 64-bit mask */
+#define GROUP_MAX 64
+
+/* add a group NAME:MEMBER,...[:COMMAND], where a MEMBER is a PID or n=NAME
+ * for the processes called NAME */
+int group_add (const char * const spec);
+
+/* check if any groups were added */
+bool group_active (void);
+
+/* check if any group has n=NAME members */
+bool group_has_names (void);
+
+/* put the members of the groups to proclist. fl must list the processes if
+ * group_has_names() */
+int group_resolve (struct filelist * fl, struct proclist * restrict proclist);
+
+/* report the groups which have no members */
+void group_start (void);
+
+/* account for p, which was dropped from proclist */
+void group_proc_done (const struct proc * const p);
+
+/* report the exit of the commands of completed groups. If block is set,
+ * wait for all of them to exit */
+void group_reap (const bool block);
+
+#endif /* PW_GROUP_H */
@@ -0,0 +1,161 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "journal.h"
+
+static struct journal_hdr *hdr = NULL;
+static struct journal_rec *recs = NULL;
+static size_t map_len = 0;
+static int journal_fd = -1;
+
+
+/* the capacity is checked by dividing, as multiplying a corrupt one could
+ * wrap around */
+static bool hdr_valid (const struct journal_hdr * const h, const size_t len)
+{
+	return !memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) &&
+	       h->version == JOURNAL_VERSION &&
+	       h->rec_size == sizeof(struct journal_rec) &&
+	       h->capacity != 0 &&
+	       h->capacity == (len - sizeof(*h)) / sizeof(struct journal_rec) &&
+	       (len - sizeof(*h)) % sizeof(struct journal_rec) == 0;
+}
+
+
+int journal_open (const char * const path)
+{
+	struct stat st;
+	void *map;
+	bool init = false;
+	/* commands started by procwait must not inherit the lock */
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd == -1)
+		return E_FAIL;
+
+	/* the lock is held for as long as the journal is open to keep out a
+	 * second writer */
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1 || fstat(fd, &st) == -1) {
+		close(fd);
+		return E_FAIL;
+	}
+
+	/* a new file is sized for the default number of records; an existing
+	 * file keeps its size, and is only used if it holds a valid journal */
+	map_len = (size_t) st.st_size;
+	if (map_len == 0) {
+		init = true;
+		map_len = sizeof(struct journal_hdr) +
+			  JOURNAL_DEFAULT_RECORDS * sizeof(struct journal_rec);
+		if (ftruncate(fd, (off_t) map_len) == -1) {
+			close(fd);
+			return E_FAIL;
+		}
+	} else if (map_len < sizeof(struct journal_hdr)) {
+		close(fd);
+		return E_INVAL;
+	}
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return E_FAIL;
+	}
+
+	if (!init && !hdr_valid(map, map_len)) {
+		munmap(map, map_len);
+		close(fd);
+		return E_INVAL;
+	}
+
+	journal_fd = fd;
+	hdr = map;
+	recs = (struct journal_rec *) (hdr + 1);
+
+	if (init) {
+		memset(map, 0, map_len);
+		memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+		hdr->version = JOURNAL_VERSION;
+		hdr->rec_size = sizeof(struct journal_rec);
+		hdr->capacity = (map_len - sizeof(*hdr)) /
+				sizeof(struct journal_rec);
+	}
+
+	return E_SUCCESS;
+}
+
+
+void journal_log (const enum JOURNAL_EV ev, const unsigned pid,
+		  const uint64_t t0, const uint64_t tick)
+{
+	struct journal_rec *r;
+	struct timespec ts;
+	uint64_t n;
+
+	if (hdr == NULL)
+		return;
+
+	n = hdr->head;
+	r = &recs[n % hdr->capacity];
+
+	/* invalidate the slot before overwriting its payload */
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	r->time = (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+	r->t0 = t0;
+	r->tick = tick;
+	r->pid = pid;
+	r->type = ev;
+
+	__atomic_store_n(&r->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->head, n + 1, __ATOMIC_RELEASE);
+}
+
+
+void journal_close (void)
+{
+	if (hdr == NULL)
+		return;
+
+	munmap(hdr, map_len);
+	close(journal_fd);
+	journal_fd = -1;
+	hdr = NULL;
+	recs = NULL;
+}
+
+
+const char * journal_ev_name (const uint32_t ev)
+{
+	switch (ev) {
+	case JE_START:
+		return "start";
+	case JE_WAIT:
+		return "wait";
+	case JE_NOT_RUNNING:
+		return "not-running";
+	case JE_TERMINATED:
+		return "terminated";
+	case JE_DONE:
+		return "done";
+	case JE_THREADS:
+		return "threads";
+	case JE_EXEC:
+		return "exec";
+	default:
+		return "unknown";
+	}
+}
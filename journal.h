@@ -0,0 +1,65 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Event journal. Events are appended as fixed size records to a ring buffer
+ * in a memory mapped file, so logging an event costs no system calls and the
+ * history survives procwait being killed.
+ *
+ * There is a single writer. A record is written by first zeroing its seq,
+ * then filling in the payload, then setting seq to the record's index + 1,
+ * and finally advancing head. A reader can copy a record and accept it if
+ * seq read before and after the copy is the index it expects. */
+
+#ifndef PW_JOURNAL_H
+#define PW_JOURNAL_H
+
+#include <stdint.h>
+
+#define JOURNAL_MAGIC "PWJOURN"
+#define JOURNAL_VERSION 1
+#define JOURNAL_DEFAULT_RECORDS 65536
+
+enum JOURNAL_EV {
+	JE_START = 1,		/* procwait started, pid is procwait's */
+	JE_WAIT,		/* started waiting for pid */
+	JE_NOT_RUNNING,		/* pid was not running at start */
+	JE_TERMINATED,		/* pid was found terminated */
+	JE_DONE,		/* procwait finished, pid is procwait's */
+	JE_THREADS,		/* pid has fewer threads than requested */
+	JE_EXEC			/* pid executed a different program */
+};
+
+struct journal_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint64_t capacity;	/* number of record slots */
+	uint64_t head;		/* number of records ever written */
+	uint8_t reserved[32];
+};
+
+struct journal_rec {
+	uint64_t seq;		/* index + 1, 0 while the record is written */
+	uint64_t time;		/* wall clock time, ns since the epoch */
+	uint64_t t0;		/* process start time, clock ticks after boot */
+	uint64_t tick;		/* pass of the wait loop */
+	uint32_t pid;
+	uint32_t type;		/* enum JOURNAL_EV */
+};
+
+/* map the journal at path, creating it if it doesn't exist or is empty. An
+ * existing journal is appended to. Returns E_INVAL if path is not a journal,
+ * which is then left untouched */
+int journal_open (const char * const path);
+
+/* append an event to the journal if one is open */
+void journal_log (const enum JOURNAL_EV ev, const unsigned pid,
+		  const uint64_t t0, const uint64_t tick);
+
+/* unmap the journal */
+void journal_close (void);
+
+/* name of an event type */
+const char * journal_ev_name (const uint32_t ev);
+
+#endif /* PW_JOURNAL_H */
@@ -0,0 +1,472 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "go.h"
+#include "latency.h"
+#include "procfs.h"
+#include "stats.h"
+#include "strutil.h"
+
+/* a stat line, up to and past the state field */
+#define LATENCY_STAT_LEN 512
+
+#define LATENCY_SPEC_LEN 64
+
+/* how a process is watched */
+enum watch {
+	W_NONE,		/* sampled on every check */
+	W_PIDFD,	/* pidfd polled for the exit */
+	W_STAT		/* stat file kept open */
+};
+
+struct watched {
+	unsigned pid;
+	unsigned tgid;
+	enum watch how;
+	int fd;
+	size_t pfd;		/* index of the pidfd among the polled fds */
+	bool gone;		/* exit was seen */
+	uint64_t alive;		/* monotonic ns the process was last seen
+				 * running */
+	uint64_t seen;		/* monotonic ns the exit was seen */
+};
+
+/* sorted by pid and tgid. proclist has no duplicates, so there is one
+ * entry for each process or thread */
+static struct watched *watched = NULL;
+static size_t nwatched = 0;
+
+/* reserved entries followed by the pidfds, and the index in watched of
+ * each pidfd */
+static struct pollfd *pfds = NULL;
+static size_t *pfd_watched = NULL;
+static size_t npfds = 0;
+static size_t pfd_reserve = 0;
+
+/* processes which have to be short-polled */
+static size_t npolled = 0;
+
+static bool active = false;
+static uint64_t interval;	/* short polling interval, ns */
+static unsigned budget = LATENCY_BUDGET_DEFAULT;
+
+/* the current sleep interval and the CPU time at its start */
+static uint64_t period;
+static uint64_t period_end;
+static uint64_t period_cpu;
+static uint64_t tick_ns;
+
+/* totals for the report */
+static uint64_t start_ns;
+static uint64_t start_cpu;
+static uint64_t nperiods = 0;
+static uint64_t nthrottled = 0;
+static bool throttled = false;
+static uint64_t nexits = 0;
+static uint64_t lat_sum = 0;
+static uint64_t lat_max = 0;
+
+
+static uint64_t clock_ns (const clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+static int cmp_watched (const void *a, const void *b)
+{
+	const struct watched *wa = a, *wb = b;
+
+	if (wa->pid != wb->pid)
+		return (wa->pid > wb->pid) - (wa->pid < wb->pid);
+	return (wa->tgid > wb->tgid) - (wa->tgid < wb->tgid);
+}
+
+
+static struct watched * find_watched (const struct proc * const p)
+{
+	struct watched key = { .pid = p->pid, .tgid = p->tgid };
+
+	return bsearch(&key, watched, nwatched, sizeof(*watched), cmp_watched);
+}
+
+
+static int pidfd_open (const unsigned pid)
+{
+#ifdef SYS_pidfd_open
+	return (int) syscall(SYS_pidfd_open, (pid_t) pid, 0);
+#else
+	(void) pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+static int open_stat (const struct proc * const p)
+{
+	char path[PROCFS_PATH_LEN];
+	int retval;
+
+	if (p->tgid != 0)
+		retval = procfs_path(path, PROCFS_PATH_LEN, "%u/task/%u/stat",
+				     p->tgid, p->pid);
+	else
+		retval = procfs_path(path, PROCFS_PATH_LEN, "%u/stat", p->pid);
+	if (retval != E_SUCCESS)
+		return -1;
+
+	stats_count(SC_OPENS, 1);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+
+/* Watch p through the first signal that can be set up. Threads have no
+ * pidfds of their own on older kernels, and a pidfd tells nothing about a
+ * synthetic proc tree. Once the fd is open, finding p still running means
+ * the fd refers to p and not to a process which has reused its PID */
+static void watch (const struct proc * const p, struct watched * restrict w)
+{
+	struct proc tmp = { .pid = 0 };
+
+	w->pid = p->pid;
+	w->tgid = p->tgid;
+	w->how = W_NONE;
+	w->fd = -1;
+	w->gone = false;
+	w->alive = clock_ns(CLOCK_MONOTONIC);
+	w->seen = w->alive;
+
+	if (p->tgid == 0 && procfs_is_default()) {
+		w->fd = pidfd_open(p->pid);
+		if (w->fd != -1)
+			w->how = W_PIDFD;
+	}
+	if (w->fd == -1 && procfs_is_default()) {
+		w->fd = open_stat(p);
+		if (w->fd != -1)
+			w->how = W_STAT;
+	}
+
+	if (w->fd != -1 && (proc_sample(p, &tmp) != E_SUCCESS ||
+			    !proc_eq(p, &tmp))) {
+		close(w->fd);
+		w->fd = -1;
+		w->how = W_NONE;
+	}
+}
+
+
+int latency_set (const char * const spec)
+{
+	char buf[LATENCY_SPEC_LEN];
+	char *slash;
+	uint64_t us;
+
+	if (snprintf(buf, LATENCY_SPEC_LEN, "%s", spec) >= LATENCY_SPEC_LEN)
+		return E_INVAL;
+
+	slash = strchr(buf, '/');
+	if (slash != NULL) {
+		*slash = '\0';
+		if (strtou(slash + 1, &budget) != E_SUCCESS || budget == 0 ||
+		    budget > 100)
+			return E_INVAL;
+	}
+
+	if (strtousec(buf, 1, &us) != E_SUCCESS || us > UINT64_MAX / 1000)
+		return E_INVAL;
+
+	interval = us * 1000;
+	active = true;
+	return E_SUCCESS;
+}
+
+
+bool latency_active (void)
+{
+	return active;
+}
+
+
+int latency_start (const struct proclist * proclist,
+		   const struct timespec * const sleep)
+{
+	const struct proc *proc;
+	size_t n = 0, npidfd = 0, nstat = 0;
+
+	SLIST_FOREACH(proc, proclist, procs)
+		++n;
+	watched = calloc(n ? n : 1, sizeof(*watched));
+	pfds = calloc(n ? n : 1, sizeof(*pfds));
+	pfd_watched = calloc(n ? n : 1, sizeof(*pfd_watched));
+	if (watched == NULL || pfds == NULL || pfd_watched == NULL)
+		return E_FAIL;
+
+	SLIST_FOREACH(proc, proclist, procs)
+		watch(proc, &watched[nwatched++]);
+	qsort(watched, nwatched, sizeof(*watched), cmp_watched);
+
+	for (size_t i = 0; i < nwatched; ++i) {
+		switch (watched[i].how) {
+		case W_PIDFD:
+			watched[i].pfd = npfds;
+			pfd_watched[npfds] = i;
+			pfds[npfds].fd = watched[i].fd;
+			pfds[npfds].events = POLLIN;
+			++npfds;
+			++npidfd;
+			break;
+		case W_STAT:
+			++nstat;
+			++npolled;
+			break;
+		case W_NONE:
+			++npolled;
+			break;
+		}
+	}
+
+	go(GO_INFO, "Watching %zu processes through pidfds, %zu through open "
+		    "stat files and %zu by sampling\n", npidfd, nstat,
+	   nwatched - npidfd - nstat);
+	if (npolled > 0)
+		go(GO_INFO, "Polling every %llu us within a CPU budget of "
+			    "%u%%\n", (unsigned long long) interval / 1000,
+		   budget);
+
+	/* timer slack would round the short polling interval up */
+	prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+	period = (uint64_t) sleep->tv_sec * 1000000000 +
+		 (uint64_t) sleep->tv_nsec;
+	start_ns = clock_ns(CLOCK_MONOTONIC);
+	start_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	period_end = start_ns + period;
+	period_cpu = start_cpu;
+	nperiods = 1;
+
+	return E_SUCCESS;
+}
+
+
+struct pollfd * latency_pollfds (const size_t reserve, size_t * restrict n)
+{
+	if (reserve > pfd_reserve) {
+		struct pollfd *tmp = realloc(pfds, (reserve + npfds) *
+						   sizeof(*pfds));
+
+		if (tmp == NULL) {
+			*n = 0;
+			return NULL;
+		}
+		memmove(tmp + reserve, tmp + pfd_reserve,
+			npfds * sizeof(*pfds));
+		pfds = tmp;
+		pfd_reserve = reserve;
+	} else if (reserve < pfd_reserve) {
+		memmove(pfds + reserve, pfds + pfd_reserve,
+			npfds * sizeof(*pfds));
+		pfd_reserve = reserve;
+	}
+
+	for (size_t i = 0; i < reserve; ++i) {
+		pfds[i].fd = -1;
+		pfds[i].events = 0;
+	}
+
+	/* once the budget is spent, exits are left to the next full check */
+	*n = throttled ? 0 : npfds;
+	return pfds;
+}
+
+
+void latency_handle (const struct pollfd * const fds, const size_t n)
+{
+	uint64_t now = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		struct watched *w = &watched[pfd_watched[i]];
+
+		if (fds[i].fd == -1 || fds[i].revents == 0 || w->gone)
+			continue;
+
+		if (now == 0)
+			now = clock_ns(CLOCK_MONOTONIC);
+		/* the kernel wakes pidfd pollers as the process exits */
+		w->gone = true;
+		w->alive = now;
+		w->seen = now;
+	}
+}
+
+
+void latency_timeout (struct timespec * restrict ts)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+	uint64_t ns = period_end > now ? period_end - now : 0;
+
+	/* the budget is checked before every short poll and every poll of the
+	 * pidfds, as each wakeup costs a pass over the processes. It is
+	 * overrun by at most the cost of one pass */
+	if ((npolled > 0 || npfds > 0) && !throttled) {
+		uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - period_cpu;
+
+		if (cpu * 100 < period * budget) {
+			if (npolled > 0 && interval < ns)
+				ns = interval;
+		} else {
+			throttled = true;
+			++nthrottled;
+		}
+	}
+
+	ts->tv_sec = (time_t) (ns / 1000000000);
+	ts->tv_nsec = (long) (ns % 1000000000);
+}
+
+
+bool latency_tick (void)
+{
+	tick_ns = clock_ns(CLOCK_MONOTONIC);
+	if (tick_ns < period_end)
+		return false;
+
+	period_end = tick_ns + period;
+	period_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	throttled = false;
+	++nperiods;
+	return true;
+}
+
+
+enum LATENCY_CHECK latency_check (const struct proc * const p)
+{
+	struct watched *w = find_watched(p);
+	char buf[LATENCY_STAT_LEN];
+	const char *paren;
+	ssize_t len;
+
+	if (w == NULL)
+		return LC_SAMPLE;
+	if (w->how == W_NONE) {
+		/* the previous sample found the process running */
+		w->alive = w->seen;
+		w->seen = tick_ns;
+		return LC_SAMPLE;
+	}
+	if (w->gone)
+		return LC_GONE;
+	if (w->how == W_PIDFD) {
+		w->alive = w->seen = tick_ns;
+		return LC_ALIVE;
+	}
+
+	/* reads fail once the process is reaped, and a zombie shows its state
+	 * after the name */
+	len = pread(w->fd, buf, LATENCY_STAT_LEN - 1, 0);
+	if (len > 0) {
+		stats_count(SC_BYTES, (uint64_t) len);
+		buf[len] = '\0';
+		paren = strrchr(buf, ')');
+		if (paren == NULL || paren[1] == '\0' ||
+		    (paren[2] != 'Z' && paren[2] != 'X')) {
+			w->alive = w->seen = tick_ns;
+			return LC_ALIVE;
+		}
+	}
+
+	w->gone = true;
+	w->seen = tick_ns;
+	return LC_GONE;
+}
+
+
+uint64_t latency_detected (const struct proc * const p)
+{
+	struct watched *w = find_watched(p);
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+	uint64_t lat;
+
+	/* the exit happened between the process was last seen running and
+	 * the exit was seen, so on average halfway */
+	if (w != NULL)
+		lat = now - w->alive / 2 - w->seen / 2;
+	else
+		lat = now - tick_ns;
+
+	++nexits;
+	lat_sum += lat;
+	if (lat > lat_max)
+		lat_max = lat;
+
+	return lat;
+}
+
+
+void latency_proc_done (const struct proc * const p)
+{
+	struct watched *w = find_watched(p);
+
+	if (w == NULL || w->fd == -1)
+		return;
+
+	if (w->how == W_PIDFD)
+		pfds[pfd_reserve + w->pfd].fd = -1;
+	else
+		--npolled;
+	close(w->fd);
+	w->fd = -1;
+}
+
+
+void latency_stop (void)
+{
+	uint64_t wall = clock_ns(CLOCK_MONOTONIC) - start_ns;
+	uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - start_cpu;
+	uint64_t mean = nexits ? lat_sum / nexits : 0;
+	double share = wall ? 100.0 * (double) cpu / (double) wall : 0;
+
+	go(GO_MESS, "Latency: %llu exits, mean %llu us, max %llu us; cpu "
+		    "%.3fs in %.3fs (%.2f%%), budget spent in %llu of %llu "
+		    "intervals\n", (unsigned long long) nexits,
+	   (unsigned long long) mean / 1000,
+	   (unsigned long long) lat_max / 1000, (double) cpu / 1e9,
+	   (double) wall / 1e9, share, (unsigned long long) nthrottled,
+	   (unsigned long long) nperiods);
+	go_event_begin(GO_MESS, "latency");
+	go_event_uint("exits", nexits);
+	go_event_uint("latency_mean_ns", mean);
+	go_event_uint("latency_max_ns", lat_max);
+	go_event_uint("cpu_ns", cpu);
+	go_event_uint("wall_ns", wall);
+	go_event_uint("intervals", nperiods);
+	go_event_uint("throttled", nthrottled);
+	go_event_end();
+
+	for (size_t i = 0; i < nwatched; ++i) {
+		if (watched[i].fd != -1)
+			close(watched[i].fd);
+	}
+	free(watched);
+	free(pfds);
+	free(pfd_watched);
+	watched = NULL;
+	pfds = NULL;
+	pfd_watched = NULL;
+	nwatched = npfds = npolled = pfd_reserve = 0;
+}
@@ -0,0 +1,72 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Low latency waiting. Each tracked process is watched through the cheapest
+ * signal available: a pidfd, which becomes readable when the process exits,
+ * or else its stat file kept open, which can't be taken over by a process
+ * reusing the PID. Between the full checks made once per sleep interval,
+ * processes without a pidfd are short-polled at a microsecond interval as
+ * long as the CPU time used within the sleep interval stays within a budget,
+ * after which procwait sleeps until the interval ends. */
+
+#ifndef PW_LATENCY_H
+#define PW_LATENCY_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "proc.h"
+
+/* default CPU budget, percent of one CPU */
+#define LATENCY_BUDGET_DEFAULT 10
+
+/* results of latency_check() */
+enum LATENCY_CHECK {
+	LC_ALIVE,	/* the process is still running */
+	LC_GONE,	/* the process has exited */
+	LC_SAMPLE	/* no cheap signal, the process must be sampled */
+};
+
+/* set the mode from INTERVAL[/BUDGET], e.g. 100us/5 */
+int latency_set (const char * const spec);
+
+/* check if the mode is on */
+bool latency_active (void);
+
+/* open the pidfds and stat files of the processes on proclist. Full checks
+ * are made every period */
+int latency_start (const struct proclist * proclist,
+		   const struct timespec * const period);
+
+/* get the pidfds to poll, preceded by reserve unused entries with fd -1 for
+ * the caller. n is set to the number of entries after the reserved ones, 0
+ * once latency_timeout() has found the CPU budget spent */
+struct pollfd * latency_pollfds (const size_t reserve, size_t * restrict n);
+
+/* handle the results of polling the n fds after the reserved entries */
+void latency_handle (const struct pollfd * const fds, const size_t n);
+
+/* set ts to the time to wait before the next check. Call before
+ * latency_pollfds() */
+void latency_timeout (struct timespec * restrict ts);
+
+/* start a pass of the wait loop. Returns true if a full check is due */
+bool latency_tick (void);
+
+/* check the process p through its cheap signal */
+enum LATENCY_CHECK latency_check (const struct proc * const p);
+
+/* account the detection of the exit of p, returns the estimated latency in
+ * ns */
+uint64_t latency_detected (const struct proc * const p);
+
+/* stop watching p */
+void latency_proc_done (const struct proc * const p);
+
+/* report the achieved latency and CPU use, and close the fds */
+void latency_stop (void);
+
+#endif /* PW_LATENCY_H */
@@ -0,0 +1,196 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* parsebench: measure the throughput of the stat file parser.
+ *
+ * Usage: parsebench [SECONDS]
+ *
+ * Two corpora are parsed for SECONDS (default 1) each: the stat lines of the
+ * processes running on this host, and a set of adversarial lines (long and
+ * whitespace laden names, overlong fields, truncated lines). The lines are
+ * parsed from memory streams, so the numbers exclude the cost of opening
+ * files in /proc. The field conversion functions are measured separately. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "go.h"
+#include "proc.h"
+#include "strutil.h"
+
+#define PROGNAME "parsebench"
+#define LINE_LEN 1024
+#define MAX_LINES 4096
+
+struct corpus {
+	char *lines[MAX_LINES];
+	size_t lens[MAX_LINES];
+	size_t n;
+};
+
+static const char * const adversarial[] = {
+	"1 (Web Content) S 1 1 1 0 -1 4194560 1 0 0 0 5 6 0 0 20 0 30 0 "
+	"1234567 8 99 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 3\n",
+	"2 (a) b) c)) S 1 1 1 0 -1 4194560 1 0 0 0 5 6 0 0 20 0 1 0 12345 "
+	"8 99\n",
+	"3 (\t \t) R 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0 12345 8 99\n",
+	"4 () R 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0 12345 8 99\n",
+	"5 (abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz) "
+	"S 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0 12345 8 99\n",
+	"6 (x) S 1 1 1 0 -1 0 1 0 0 0 99999999999999999999999999999999999 6 "
+	"0 0 20 0 1 0 12345 8 99\n",
+	"7 (x) S 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0 18446744073709551615 "
+	"8 4294967296\n",
+	"8 (x) S 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0",
+	"9 (x",
+	"(",
+	"",
+	"                                                                  ",
+	"4294967295 (x) S 1 1 1 0 -1 0 1 0 0 0 -5 6 0 0 20 0 1 0 -1 8 99\n",
+	"10 (x) S 1 1 1 0 -1 0 1 0 0 0 5 6 0 0 20 0 1 0 12345 8 99 "
+	"1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24\n"
+};
+
+
+static double now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+static void add_line (struct corpus * restrict c, const char * const line,
+		      const size_t len)
+{
+	if (c->n == MAX_LINES)
+		return;
+
+	c->lines[c->n] = malloc(len + 1);
+	memcpy(c->lines[c->n], line, len + 1);
+	c->lens[c->n] = len;
+	++c->n;
+}
+
+
+static void load_host (struct corpus * restrict c)
+{
+	DIR *dir = opendir("/proc");
+	struct dirent *de;
+
+	if (dir == NULL)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		char path[300], line[LINE_LEN];
+		FILE *f;
+		size_t len;
+
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		len = fread(line, 1, LINE_LEN - 1, f);
+		line[len] = '\0';
+		fclose(f);
+
+		if (len > 0)
+			add_line(c, line, len);
+	}
+
+	closedir(dir);
+}
+
+
+/* parse every line of c repeatedly for secs seconds */
+static void bench_parse (const char * const name,
+			 const struct corpus * const c, const double secs)
+{
+	unsigned long long lines = 0, bytes = 0, ok = 0;
+	double start = now(), elapsed;
+
+	if (c->n == 0)
+		return;
+
+	do {
+		for (size_t i = 0; i < c->n; ++i) {
+			struct proc p;
+			FILE *f = fmemopen(c->lines[i], c->lens[i] + 1, "r");
+
+			if (f == NULL)
+				continue;
+			if (parse_stat_stream(f, name, &p) == 0)
+				++ok;
+			fclose(f);
+			bytes += c->lens[i];
+		}
+		lines += c->n;
+		elapsed = now() - start;
+	} while (elapsed < secs);
+
+	printf("%-12s %6zu lines  %10.0f lines/s  %8.1f MB/s  %llu ok\n",
+	       name, c->n, (double) lines / elapsed,
+	       (double) bytes / elapsed / 1e6, ok / (lines / c->n));
+}
+
+
+/* convert the numeric fields of c repeatedly for secs seconds */
+static void bench_strtou (const struct corpus * const c, const double secs)
+{
+	unsigned long long fields = 0;
+	double start = now(), elapsed;
+	volatile uint64_t sink = 0;
+
+	if (c->n == 0)
+		return;
+
+	do {
+		for (size_t i = 0; i < c->n; ++i) {
+			char buf[LINE_LEN];
+			char *tok, *save;
+			unsigned u;
+			uint64_t u64;
+
+			memcpy(buf, c->lines[i], c->lens[i] + 1);
+			for (tok = strtok_r(buf, " \n", &save); tok != NULL;
+			     tok = strtok_r(NULL, " \n", &save)) {
+				if (strtou(tok, &u) == 0)
+					sink += u;
+				if (strtou64(tok, &u64) == 0)
+					sink += u64;
+				++fields;
+			}
+		}
+		elapsed = now() - start;
+	} while (elapsed < secs);
+
+	printf("%-12s %10.0f fields/s (strtou + strtou64)\n", "convert",
+	       (double) fields / elapsed);
+}
+
+
+int main (int argc, char **argv)
+{
+	struct corpus host = { .n = 0 }, adv = { .n = 0 };
+	double secs = argc > 1 ? strtod(argv[1], NULL) : 1.0;
+
+	/* parse warnings of the adversarial lines are expected */
+	go_set_lvl(GO_QUIET);
+
+	load_host(&host);
+	for (size_t i = 0; i < sizeof(adversarial) / sizeof(*adversarial); ++i)
+		add_line(&adv, adversarial[i], strlen(adversarial[i]));
+
+	bench_parse("host", &host, secs);
+	bench_parse("adversarial", &adv, secs);
+	bench_strtou(&host, secs);
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Fuzzing harness for the stat file parser and the field conversions.
+ *
+ * Built with -DLIBFUZZER this is a libFuzzer target. Otherwise it reads a
+ * single input from stdin, which suits AFL and replaying crashes. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "go.h"
+#include "proc.h"
+#include "strutil.h"
+
+#define MAX_INPUT 65536
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+	char *buf;
+	FILE *f;
+	struct proc p;
+	unsigned u;
+	uint64_t u64;
+
+	go_set_lvl(GO_QUIET);
+
+	/* the field conversions take nul terminated strings */
+	buf = malloc(size + 1);
+	if (buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	buf[size] = '\0';
+
+	strtou(buf, &u);
+	strtou64(buf, &u64);
+
+	/* fmemopen() refuses empty buffers, so include the '\0' */
+	f = fmemopen(buf, size + 1, "r");
+	if (f != NULL) {
+		memset(&p, 0xa5, sizeof(p));
+		if (parse_stat_stream(f, "fuzz", &p) == 0 &&
+		    strlen(p.name) >= PNAME_LEN)
+			abort();
+		fclose(f);
+	}
+
+	free(buf);
+	return 0;
+}
+
+
+#ifndef LIBFUZZER
+int main (void)
+{
+	static uint8_t input[MAX_INPUT];
+	size_t len = fread(input, 1, MAX_INPUT, stdin);
+
+	return LLVMFuzzerTestOneInput(input, len);
+}
+#endif
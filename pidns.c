@@ -0,0 +1,301 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "fileutil.h"
+#include "go.h"
+#include "pidns.h"
+#include "procfs.h"
+#include "stats.h"
+#include "strutil.h"
+
+/* the NSpid line is found before the longer lines of status */
+#define STATUS_LINE_LEN 256
+
+struct nsent {
+	unsigned local;		/* PID in the namespace */
+	unsigned pid;		/* PID in the proc root */
+};
+
+struct pidns {
+	dev_t dev;		/* identity of the namespace */
+	ino_t ino;
+	struct nsent *ents;	/* sorted by local after each pass */
+	size_t n;
+	size_t cap;
+};
+
+static struct pidns *nss = NULL;
+static size_t nns = 0;
+
+/* sorted PIDs of the processes that existed on the previous pass */
+static unsigned *seen = NULL;
+static size_t nseen = 0;
+
+
+static int cmp_nsent (const void *a, const void *b)
+{
+	const struct nsent *x = a, *y = b;
+
+	return (x->local > y->local) - (x->local < y->local);
+}
+
+
+static int cmp_uint (const void *a, const void *b)
+{
+	const unsigned *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+
+/* the PID namespace of process pid */
+static int stat_ns (const unsigned pid, struct stat * restrict st)
+{
+	char path[PROCFS_PATH_LEN];
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "%u/ns/pid", pid) != E_SUCCESS)
+		return E_FAIL;
+
+	stats_count(SC_OPENS, 1);
+	return stat(path, st) == 0 ? E_SUCCESS : E_FAIL;
+}
+
+
+static struct pidns * find_ns (const struct stat * const st)
+{
+	for (size_t i = 0; i < nns; ++i) {
+		if (nss[i].dev == st->st_dev && nss[i].ino == st->st_ino)
+			return &nss[i];
+	}
+
+	return NULL;
+}
+
+
+/* PID of process pid in its own namespace, the last one on its NSpid
+ * line */
+static int read_nspid (const unsigned pid, unsigned * restrict local)
+{
+	char path[PROCFS_PATH_LEN];
+	char line[STATUS_LINE_LEN];
+	int retval = E_FAIL;
+	FILE *file;
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "%u/status", pid) != E_SUCCESS)
+		return E_FAIL;
+
+	file = fopen(path, "r");
+	stats_count(SC_OPENS, 1);
+	if (file == NULL)
+		return E_FAIL;
+
+	while (fgets(line, STATUS_LINE_LEN, file) != NULL) {
+		char *last;
+
+		if (strncmp(line, "NSpid:", 6))
+			continue;
+
+		line[strcspn(line, "\n")] = '\0';
+		last = strrchr(line, '\t');
+		if (last == NULL)
+			last = line + 6;
+		retval = strtou(last + strspn(last, " \t"), local);
+		break;
+	}
+
+	fclose(file);
+	return retval;
+}
+
+
+/* add pid to the index if it is in one of the namespaces */
+static void index_pid (const unsigned pid)
+{
+	struct stat st;
+	struct pidns *ns;
+	unsigned local;
+
+	if (stat_ns(pid, &st) != E_SUCCESS)
+		return;
+
+	ns = find_ns(&st);
+	if (ns == NULL || read_nspid(pid, &local) != E_SUCCESS)
+		return;
+
+	if (ns->n == ns->cap) {
+		size_t cap = ns->cap ? 2 * ns->cap : 64;
+		struct nsent *tmp = realloc(ns->ents, cap * sizeof(*tmp));
+
+		if (tmp == NULL)
+			return;
+		ns->ents = tmp;
+		ns->cap = cap;
+	}
+
+	ns->ents[ns->n].local = local;
+	ns->ents[ns->n].pid = pid;
+	++ns->n;
+}
+
+
+/* drop the entries of processes which are gone */
+static void drop_gone (const unsigned * const gone, const size_t ngone)
+{
+	for (size_t i = 0; i < nns; ++i) {
+		struct pidns *ns = &nss[i];
+		size_t j = 0;
+
+		for (size_t k = 0; k < ns->n; ++k) {
+			if (bsearch(&ns->ents[k].pid, gone, ngone,
+				    sizeof(*gone), cmp_uint) == NULL)
+				ns->ents[j++] = ns->ents[k];
+		}
+		ns->n = j;
+	}
+}
+
+
+/* index the processes that weren't there on the previous pass */
+static int update (void)
+{
+	unsigned *pids, *gone;
+	size_t npids, ngone = 0, j = 0;
+
+	if (get_proc_pids(&pids, &npids) != E_SUCCESS)
+		return E_FAIL;
+
+	gone = malloc((nseen ? nseen : 1) * sizeof(*gone));
+	if (gone == NULL) {
+		free(pids);
+		return E_FAIL;
+	}
+
+	/* both listings are sorted */
+	for (size_t i = 0; i < npids; ++i) {
+		while (j < nseen && seen[j] < pids[i])
+			gone[ngone++] = seen[j++];
+		if (j < nseen && seen[j] == pids[i]) {
+			++j;
+			continue;
+		}
+		index_pid(pids[i]);
+	}
+	while (j < nseen)
+		gone[ngone++] = seen[j++];
+
+	if (ngone > 0)
+		drop_gone(gone, ngone);
+	free(gone);
+
+	free(seen);
+	seen = pids;
+	nseen = npids;
+
+	for (size_t i = 0; i < nns; ++i)
+		qsort(nss[i].ents, nss[i].n, sizeof(*nss[i].ents), cmp_nsent);
+
+	return E_SUCCESS;
+}
+
+
+int pidns_add (const char * const ns, unsigned * restrict idx)
+{
+	struct stat st;
+	struct pidns *tmp;
+	unsigned pid;
+
+	if (strtou(ns, &pid) == E_SUCCESS) {
+		if (stat_ns(pid, &st) != E_SUCCESS) {
+			go(GO_ERR, "Could not find the PID namespace of %u: "
+				   "%s\n", pid, strerror(errno));
+			return E_FAIL;
+		}
+	} else if (stat(ns, &st) != 0) {
+		go(GO_ERR, "Could not stat PID namespace '%s': %s\n", ns,
+		   strerror(errno));
+		return E_FAIL;
+	}
+
+	for (size_t i = 0; i < nns; ++i) {
+		if (nss[i].dev == st.st_dev && nss[i].ino == st.st_ino) {
+			*idx = (unsigned) i;
+			return E_SUCCESS;
+		}
+	}
+
+	tmp = realloc(nss, (nns + 1) * sizeof(*tmp));
+	if (tmp == NULL)
+		return E_FAIL;
+	nss = tmp;
+
+	memset(&nss[nns], 0, sizeof(*nss));
+	nss[nns].dev = st.st_dev;
+	nss[nns].ino = st.st_ino;
+	*idx = (unsigned) nns++;
+
+	return E_SUCCESS;
+}
+
+
+int pidns_build (void)
+{
+	return nns > 0 ? update() : E_SUCCESS;
+}
+
+
+int pidns_lookup (const unsigned idx, const unsigned local,
+		  unsigned * restrict pid)
+{
+	struct nsent key = { local, 0 };
+	struct pidns *ns = &nss[idx];
+	bool updated = false;
+
+	for (;;) {
+		struct nsent *ent;
+		struct stat st;
+		unsigned now;
+
+		ent = bsearch(&key, ns->ents, ns->n, sizeof(*ns->ents),
+			      cmp_nsent);
+
+		if (ent == NULL) {
+			/* the process may have started after the latest pass */
+			if (updated || update() != E_SUCCESS)
+				return E_FAIL;
+			updated = true;
+			continue;
+		}
+
+		if (stat_ns(ent->pid, &st) == E_SUCCESS && find_ns(&st) == ns &&
+		    read_nspid(ent->pid, &now) == E_SUCCESS && now == local) {
+			*pid = ent->pid;
+			return E_SUCCESS;
+		}
+
+		/* the process was replaced since it was indexed */
+		memmove(ent, ent + 1,
+			(size_t) (ns->ents + ns->n - ent - 1) * sizeof(*ent));
+		--ns->n;
+	}
+}
+
+
+void pidns_free (void)
+{
+	for (size_t i = 0; i < nns; ++i)
+		free(nss[i].ents);
+	free(nss);
+	free(seen);
+	nss = NULL;
+	seen = NULL;
+	nns = 0;
+	nseen = 0;
+}
@@ -0,0 +1,28 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Translation of PIDs local to a PID namespace, e.g. of a container, to the
+ * PIDs procwait sees. An index of the processes in the namespaces of
+ * interest is built with one pass over the proc root, reading the NSpid line
+ * of /proc/PID/status only for processes whose /proc/PID/ns/pid is one of
+ * those namespaces. Lookups that miss update the index with only the
+ * processes started after the previous pass. */
+
+#ifndef PW_PIDNS_H
+#define PW_PIDNS_H
+
+/* add the namespace ns, given as the PID of a process in it or as a path to
+ * a namespace file such as /proc/PID/ns/pid. Its index is put to idx */
+int pidns_add (const char * const ns, unsigned * restrict idx);
+
+/* build the index of the added namespaces */
+int pidns_build (void);
+
+/* translate the PID local in namespace idx to a PID in the proc root */
+int pidns_lookup (const unsigned idx, const unsigned local,
+		  unsigned * restrict pid);
+
+/* free the index */
+void pidns_free (void);
+
+#endif /* PW_PIDNS_H */
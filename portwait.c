@@ -0,0 +1,334 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "fdscan.h"
+#include "fileutil.h"
+#include "go.h"
+#include "portwait.h"
+#include "proc.h"
+#include "procfs.h"
+#include "queue.h"
+#include "stats.h"
+#include "strutil.h"
+
+/* longer lines of the socket tables are only read partially */
+#define PORTWAIT_LINE_LEN 256
+
+#define PORT_MAX 65535
+
+/* state of a listening TCP socket in the socket tables */
+#define TCP_LISTEN 0x0A
+
+static const struct {
+	const char *path;
+	bool tcp;
+} tables[] = {
+	{ "net/tcp",	true },
+	{ "net/tcp6",	true },
+	{ "net/udp",	false },
+	{ "net/udp6",	false }
+};
+
+static uint64_t *ports = NULL;
+static size_t nports = 0;
+
+/* sockets bound to the ports as of the latest round */
+static struct fdset set = { NULL, 0, true, NULL, 0 };
+static struct proclist owners = SLIST_HEAD_INITIALIZER(owners);
+
+
+static const char * ports_str (void)
+{
+	static char buf[STAT_COL_LEN];
+
+	if (nports > 1)
+		return "the ports";
+
+	snprintf(buf, STAT_COL_LEN, "port %u", (unsigned) ports[0]);
+	return buf;
+}
+
+
+static void report_released (void)
+{
+	go(GO_MESS, "No socket is bound to %s\n", ports_str());
+	go_event_begin(GO_MESS, "port-released");
+	go_event_uints("ports", ports, nports);
+	go_event_end();
+}
+
+
+static bool is_port (const unsigned port)
+{
+	for (size_t i = 0; i < nports; ++i)
+		if (ports[i] == port)
+			return true;
+
+	return false;
+}
+
+
+/* add the inodes of the sockets bound to the ports in table to found */
+static int read_table (const char * const table, const bool tcp,
+		       struct fdset * restrict found)
+{
+	char path[PROCFS_PATH_LEN];
+	char line[PORTWAIT_LINE_LEN];
+	FILE *file;
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "%s", table) != E_SUCCESS)
+		return E_FAIL;
+
+	file = fopen(path, "r");
+	stats_count(SC_OPENS, 1);
+	if (file == NULL)
+		/* no IPv6 */
+		return errno == ENOENT ? E_SUCCESS : E_FAIL;
+
+	/* skip the header */
+	if (fgets(line, PORTWAIT_LINE_LEN, file) == NULL) {
+		fclose(file);
+		return E_SUCCESS;
+	}
+
+	while (fgets(line, PORTWAIT_LINE_LEN, file) != NULL) {
+		unsigned port, state;
+		unsigned long inode;
+		struct fdkey *keys;
+
+		if (sscanf(line, " %*u: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%*x %x "
+				 "%*x:%*x %*x:%*x %*x %*u %*u %lu",
+			   &port, &state, &inode) != 3)
+			continue;
+
+		if (!is_port(port) || inode == 0 ||
+		    (tcp && state != TCP_LISTEN))
+			continue;
+
+		keys = realloc(found->keys, (found->n + 1) * sizeof(*keys));
+		if (keys == NULL) {
+			fclose(file);
+			return E_FAIL;
+		}
+		keys[found->n].dev = 0;
+		keys[found->n].ino = (ino_t) inode;
+		found->keys = keys;
+		++found->n;
+	}
+
+	stats_count(SC_BYTES, (uint64_t) ftell(file));
+	fclose(file);
+	return E_SUCCESS;
+}
+
+
+static int read_sockets (struct fdset * restrict found)
+{
+	found->keys = NULL;
+	found->n = 0;
+	found->sockets = true;
+	found->devs = NULL;
+	found->ndevs = 0;
+
+	for (size_t i = 0; i < sizeof(tables) / sizeof(*tables); ++i) {
+		if (read_table(tables[i].path, tables[i].tcp, found)
+		    != E_SUCCESS) {
+			free(found->keys);
+			found->keys = NULL;
+			found->n = 0;
+			return E_FAIL;
+		}
+	}
+
+	fdset_sort(found);
+	return E_SUCCESS;
+}
+
+
+static bool is_owner (const unsigned pid)
+{
+	struct proc *proc;
+
+	SLIST_FOREACH(proc, &owners, procs)
+		if (proc->pid == pid)
+			return true;
+
+	return false;
+}
+
+
+/* start tracking pid as an owner */
+static void add_owner (const unsigned pid)
+{
+	struct proc *proc;
+
+	if (is_owner(pid))
+		return;
+
+	proc = malloc(sizeof(struct proc));
+	if (proc == NULL)
+		return;
+
+	if (parse_stat_pid(pid, proc) != E_SUCCESS) {
+		free(proc);
+		return;
+	}
+
+	go(GO_MESS, "Waiting for PID %u (%s) to release %s\n", proc->pid,
+	   proc->name, ports_str());
+	go_event_begin(GO_MESS, "port-owner");
+	go_event_uint("pid", proc->pid);
+	go_event_str("name", proc->name);
+	go_event_uint("t0", proc->t0);
+	go_event_end();
+
+	SLIST_INSERT_HEAD(&owners, proc, procs);
+}
+
+
+/* find the owners of the sockets in fresh with one scan of all processes */
+static void scan_owners (const struct fdset * const fresh)
+{
+	unsigned *pids, *found;
+	size_t npids, nfound;
+
+	if (get_proc_pids(&pids, &npids) != E_SUCCESS) {
+		go(GO_WARN, "Could not list processes\n");
+		return;
+	}
+
+	found = malloc((npids ? npids : 1) * sizeof(*found));
+	if (found == NULL) {
+		free(pids);
+		return;
+	}
+
+	nfound = fdscan_pids(pids, npids, fresh, found, NULL,
+			     fdscan_threads());
+	for (size_t i = 0; i < nfound; ++i)
+		add_owner(found[i]);
+
+	free(found);
+	free(pids);
+}
+
+
+static void clear_owners (void)
+{
+	while (!SLIST_EMPTY(&owners)) {
+		struct proc *proc = SLIST_FIRST(&owners);
+
+		SLIST_REMOVE_HEAD(&owners, procs);
+		free(proc);
+	}
+}
+
+
+int portwait_add (const char * const port)
+{
+	uint64_t *tmp;
+	unsigned num;
+
+	if (strtou(port, &num) != E_SUCCESS || num == 0 || num > PORT_MAX)
+		return E_INVAL;
+
+	tmp = realloc(ports, (nports + 1) * sizeof(*tmp));
+	if (tmp == NULL)
+		return E_FAIL;
+
+	tmp[nports++] = num;
+	ports = tmp;
+
+	return E_SUCCESS;
+}
+
+
+bool portwait_active (void)
+{
+	return nports > 0;
+}
+
+
+int portwait_start (void)
+{
+	if (nports == 0)
+		return E_SUCCESS;
+
+	if (read_sockets(&set) != E_SUCCESS) {
+		go(GO_ERR, "Could not read the socket tables\n");
+		return E_FAIL;
+	}
+
+	if (set.n > 0)
+		scan_owners(&set);
+	else
+		report_released();
+
+	return E_SUCCESS;
+}
+
+
+void portwait_tick (void)
+{
+	struct proc *proc, *tmp_proc;
+	struct fdset now, fresh = { NULL, 0, true, NULL, 0 };
+	size_t j = 0;
+
+	if (set.n == 0)
+		return;
+
+	/* report the owners that terminated */
+	SLIST_FOREACH_SAFE(proc, &owners, procs, tmp_proc) {
+		struct proc tmp = { .pid = 0 };
+
+		if (parse_stat_pid(proc->pid, &tmp) != E_SUCCESS ||
+		    !proc_eq(proc, &tmp)) {
+			SLIST_REMOVE(&owners, proc, proc, procs);
+			proc_report(proc);
+			free(proc);
+		} else {
+			proc_add_sample(proc, &tmp);
+		}
+	}
+
+	if (read_sockets(&now) != E_SUCCESS)
+		return;
+
+	/* the sockets not seen on the previous round, both sets are sorted */
+	fresh.keys = malloc((now.n ? now.n : 1) * sizeof(*fresh.keys));
+	if (fresh.keys == NULL) {
+		free(now.keys);
+		return;
+	}
+	for (size_t i = 0; i < now.n; ++i) {
+		while (j < set.n && set.keys[j].ino < now.keys[i].ino)
+			++j;
+		if (j < set.n && set.keys[j].ino == now.keys[i].ino)
+			continue;
+		fresh.keys[fresh.n++] = now.keys[i];
+	}
+
+	if (fresh.n > 0)
+		scan_owners(&fresh);
+	free(fresh.keys);
+
+	free(set.keys);
+	set = now;
+
+	if (set.n == 0) {
+		report_released();
+		clear_owners();
+	}
+}
+
+
+bool portwait_done (void)
+{
+	return set.n == 0;
+}
@@ -0,0 +1,30 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Waiting until TCP and UDP ports are released. The sockets bound to the
+ * ports (listening ones for TCP) are read from /proc/net/{tcp,udp}{,6} on
+ * every round. Their owners are found with a scan of the open file
+ * descriptors of all processes, but only when sockets not seen on the
+ * previous round appear. */
+
+#ifndef PW_PORTWAIT_H
+#define PW_PORTWAIT_H
+
+#include <stdbool.h>
+
+/* add a port to wait for */
+int portwait_add (const char * const port);
+
+/* check if any ports were added */
+bool portwait_active (void);
+
+/* find the sockets bound to the ports and their owners */
+int portwait_start (void);
+
+/* check the owners and the sockets */
+void portwait_tick (void);
+
+/* check if no socket is bound to the ports anymore */
+bool portwait_done (void);
+
+#endif /* PW_PORTWAIT_H */
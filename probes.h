@@ -0,0 +1,30 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* USDT probes for tracing procwait with perf, bpftrace or systemtap. The
+ * probes are compiled in only if USDT is defined (see config.mk), otherwise
+ * they expand to nothing. A probe in a built binary is a single nop until a
+ * tracer attaches to it. All probes are in provider "procwait". */
+
+#ifndef PW_PROBES_H
+#define PW_PROBES_H
+
+#ifdef USDT
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)		DTRACE_PROBE(procwait, name)
+#define PROBE1(name, a)		DTRACE_PROBE1(procwait, name, a)
+#define PROBE2(name, a, b)	DTRACE_PROBE2(procwait, name, a, b)
+#define PROBE3(name, a, b, c)	DTRACE_PROBE3(procwait, name, a, b, c)
+
+#else
+
+#define PROBE0(name)		do { } while (0)
+#define PROBE1(name, a)		do { } while (0)
+#define PROBE2(name, a, b)	do { } while (0)
+#define PROBE3(name, a, b, c)	do { } while (0)
+
+#endif /* USDT */
+
+#endif /* PW_PROBES_H */
@@ -6,42 +6,78 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "go.h"
+#include "probes.h"
 #include "proc.h"
+#include "procfs.h"
+#include "stats.h"
 #include "strutil.h"
 
-#define FILENAME_BUF_LEN 32
-
 /* Field indexes for file /proc/PID/stat */
 enum {
 	STAT_PID = 0,
 	STAT_PNAME = 1,
+	STAT_UTIME = 13,
+	STAT_STIME = 14,
+	STAT_THREADS = 19,
 	STAT_T0 = 21,
+	STAT_RSS = 23,
+	STAT_STARTCODE = 25,
+	STAT_ENDCODE = 26,
 	STAT_FIELDS
 };
 
 
+/* longest stat line read. The fields procwait uses come long before the
+ * end of the line, so the rest of a longer line is not needed */
+#define STAT_LINE_LEN 1024
+
 static void cp_pname_field(char *dest, const char *src);
+static int next_field (char ** pos, char * buf, const size_t len);
 static int handle_field (const unsigned field, const char * const field_buf,
 			 struct proc * restrict p);
 
 
+/* copy the name without its parentheses, at most PNAME_LEN-1 characters as
+ * the kernel never reports more */
 static void cp_pname_field(char *dest, const char *src)
 {
-	/* skip the leading '(' */
-	++src;
-	/* Just copy the process name, both field's width is STAT_COL_LEN */
-	strcpy(dest, src);
-	int i = 0;
-	while (src[i] != '\0') {
+	size_t i = 0;
+
+	while (src[i] != '\0' && i < PNAME_LEN - 1) {
 		dest[i] = src[i];
 		++i;
 	}
+	dest[i] = '\0';
+}
+
+
+/* copy the next whitespace separated field at *pos to buf and move *pos past
+ * it */
+static int next_field (char ** pos, char * buf, const size_t len)
+{
+	char *s = *pos;
+	size_t n = 0;
+
+	while (*s != '\0' && is_whitespace(*s))
+		++s;
+	while (s[n] != '\0' && !is_whitespace(s[n]))
+		++n;
+	*pos = s + n;
+
+	if (n >= len) {
+		memcpy(buf, s, len - 1);
+		buf[len - 1] = '\0';
+		return STRUTIL_EXIT_TRUNCATED;
+	}
 
-	/* skip the trailing ')' */
-	dest[i-1] = '\0';
+	memcpy(buf, s, n);
+	buf[n] = '\0';
+	return n > 0 ? STRUTIL_EXIT_SUCCESS : STRUTIL_EXIT_EOF;
 }
 
 
@@ -49,18 +85,43 @@ static int handle_field (const unsigned field, const char * const field_buf,
 			 struct proc * restrict p)
 {
 	int success = E_SUCCESS;
+	uint64_t addr;
 
 	switch (field) {
 	case STAT_PID:
 		success = strtou(field_buf, &(p->pid));
 		break;
 
-	case STAT_PNAME:
-		cp_pname_field(p->name, field_buf);
+	case STAT_UTIME:
+		success = strtou64(field_buf, &(p->stats.utime));
+		break;
+
+	case STAT_STIME:
+		success = strtou64(field_buf, &(p->stats.stime));
+		break;
+
+	case STAT_THREADS:
+		success = strtou(field_buf, &(p->stats.threads));
 		break;
 
 	case STAT_T0:
-		success = strtou(field_buf, &(p->t0));
+		success = strtou64(field_buf, &(p->t0));
+		break;
+
+	case STAT_RSS:
+		success = strtou(field_buf, &(p->stats.rss));
+		break;
+
+	/* the text is far smaller than 4 GB, so the low bits of the addresses
+	 * are enough to get its size */
+	case STAT_STARTCODE:
+		success = strtou64(field_buf, &addr);
+		p->text = (uint32_t) addr;
+		break;
+
+	case STAT_ENDCODE:
+		success = strtou64(field_buf, &addr);
+		p->text = (uint32_t) addr - p->text;
 		break;
 
 	default:
@@ -75,9 +136,10 @@ static int handle_field (const unsigned field, const char * const field_buf,
 
 int parse_stat_file (const char * path, struct proc * p)
 {
-	int retval = E_SUCCESS;
+	int retval;
 	FILE *file = fopen(path, "r");
 
+	stats_count(SC_OPENS, 1);
 	if (file == NULL) {
 		/* check if error is 'file does not exist' (which is ok, the
 		 * process has terminated) or if some other error happened */
@@ -86,47 +148,206 @@ int parse_stat_file (const char * path, struct proc * p)
 		return E_FAIL;
 	}
 
+	retval = parse_stat_stream(file, path, p);
+
+	stats_count(SC_BYTES, (uint64_t) ftell(file));
+	fclose(file);
+	return retval;
+}
+
+
+int parse_stat_stream (FILE * file, const char * path, struct proc * p)
+{
+	char line[STAT_LINE_LEN];
+	char *name, *name_end, *pos = line;
+	size_t len;
+	int retval = E_SUCCESS;
+
+	/* the stat file doesn't tell if it is of a thread */
+	p->tgid = 0;
+
+	/* The name is in parentheses and may contain anything, whitespace and
+	 * ") " included, so it can't be split on whitespace. Nothing after it
+	 * contains a ')', so it ends at the last one on the line */
+	len = fread(line, 1, STAT_LINE_LEN - 1, file);
+	line[len] = '\0';
+	name = strchr(line, '(');
+	name_end = strrchr(line, ')');
+	if (name == NULL || name_end == NULL || name_end < name) {
+		PROBE2(parse__fail, path, STAT_PNAME);
+		return E_FAIL;
+	}
+	*name++ = '\0';
+	*name_end = '\0';
+
 	/* loop the fields */
 	for (unsigned field = 0; field < STAT_FIELDS; ++field) {
 		char field_buf[STAT_COL_LEN];
 
 		/* get next field */
-		int field_succ = get_next_field(file, field_buf, STAT_COL_LEN);
+		if (field == STAT_PNAME) {
+			cp_pname_field(p->name, name);
+			pos = name_end + 1;
+			continue;
+		}
 
-		if (field_succ == STRUTIL_EXIT_TRUNCATED) {
+		if (next_field(&pos, field_buf, STAT_COL_LEN) ==
+		    STRUTIL_EXIT_TRUNCATED) {
 			go(GO_WARN, "Parsing field number %u in %s failed: "
 				    "too long record\n", field, path);
 		}
 
 		/* if handling a required field fails, bail out */
 		if (handle_field(field, field_buf, p) !=  E_SUCCESS) {
+			PROBE2(parse__fail, path, field);
 			retval = E_FAIL;
 			break;
 		}
 	}
 
-	fclose(file);
+	/* a freshly parsed process is its own first sample */
+	p->stats.rss_peak = p->stats.rss;
+	p->stats.samples = 1;
+
 	return retval;
 }
 
 
 int parse_stat_pid (const unsigned pid, struct proc * restrict p)
 {
-	char filename[FILENAME_BUF_LEN];
-	snprintf(filename, FILENAME_BUF_LEN, "/proc/%u/stat", pid);
+	char filename[PROCFS_PATH_LEN];
+
+	if (procfs_path(filename, PROCFS_PATH_LEN, "%u/stat", pid) != E_SUCCESS)
+		return E_FAIL;
+	parse_stat_file (filename, p);
+
+	return validate_proc(p) ? E_SUCCESS : E_FAIL;
+}
+
+
+int parse_stat_task (const unsigned tgid, const unsigned tid,
+		     struct proc * restrict p)
+{
+	char filename[PROCFS_PATH_LEN];
+
+	if (procfs_path(filename, PROCFS_PATH_LEN, "%u/task/%u/stat", tgid,
+			tid) != E_SUCCESS)
+		return E_FAIL;
 	parse_stat_file (filename, p);
+	p->tgid = tgid;
 
 	return validate_proc(p) ? E_SUCCESS : E_FAIL;
 }
 
 
+int proc_sample (const struct proc * const p, struct proc * sample)
+{
+	if (p->tgid != 0)
+		return parse_stat_task(p->tgid, p->pid, sample);
+	else
+		return parse_stat_pid(p->pid, sample);
+}
+
+
+int proc_tgid (const unsigned tid, unsigned * restrict tgid)
+{
+	char filename[PROCFS_PATH_LEN];
+	char line[STAT_COL_LEN];
+	int retval = E_FAIL;
+	FILE *file;
+
+	/* /proc/TID is there for threads too, only unlisted */
+	if (procfs_path(filename, PROCFS_PATH_LEN, "%u/status", tid)
+	    != E_SUCCESS)
+		return E_FAIL;
+
+	file = fopen(filename, "r");
+	stats_count(SC_OPENS, 1);
+	if (file == NULL)
+		return E_FAIL;
+
+	while (fgets(line, STAT_COL_LEN, file) != NULL) {
+		if (!strncmp(line, "Tgid:", 5)) {
+			line[strcspn(line, "\n")] = '\0';
+			retval = strtou(line + 5 + strspn(line + 5, " \t"),
+					tgid);
+			break;
+		}
+	}
+
+	fclose(file);
+	return retval;
+}
+
+
+void proc_add_sample (struct proc * restrict p,
+		      const struct proc * restrict sample)
+{
+	p->stats.utime = sample->stats.utime;
+	p->stats.stime = sample->stats.stime;
+	p->stats.rss = sample->stats.rss;
+	if (sample->stats.rss > p->stats.rss_peak)
+		p->stats.rss_peak = sample->stats.rss;
+	++p->stats.samples;
+}
+
+
+void proc_report (const struct proc * const p)
+{
+	static long hz = 0;
+	static long page_kb = 0;
+	const char *kind = p->tgid != 0 ? "Thread" : "Process";
+	struct timespec now;
+	double uptime;
+
+	if (hz == 0) {
+		hz = sysconf(_SC_CLK_TCK);
+		page_kb = sysconf(_SC_PAGESIZE) / 1024;
+	}
+
+	clock_gettime(CLOCK_BOOTTIME, &now);
+	uptime = (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+
+	if (go_format() == GO_JSON) {
+		go_event_begin(GO_MESS, "terminated");
+		go_event_uint("pid", p->pid);
+		if (p->tgid != 0)
+			go_event_uint("tgid", p->tgid);
+		go_event_str("name", p->name);
+		go_event_uint("t0", p->t0);
+		go_event_num("lifetime", uptime - (double) p->t0 / hz);
+		go_event_num("utime", (double) p->stats.utime / hz);
+		go_event_num("stime", (double) p->stats.stime / hz);
+		go_event_uint("rss_kb", (uint64_t) p->stats.rss * page_kb);
+		go_event_uint("rss_peak_kb",
+			      (uint64_t) p->stats.rss_peak * page_kb);
+		go_event_uint("samples", p->stats.samples);
+		go_event_end();
+		return;
+	}
+
+	go(GO_MESS, "%s %u %s terminated\n", kind, p->pid, p->name);
+	go(GO_MESS, "%s %u %s: lifetime %.2fs, cpu %.2fs user "
+		    "%.2fs system, rss %lu kB, peak rss %lu kB, %u samples\n",
+	   kind, p->pid, p->name,
+	   uptime - (double) p->t0 / hz,
+	   (double) p->stats.utime / hz,
+	   (double) p->stats.stime / hz,
+	   (unsigned long) p->stats.rss * page_kb,
+	   (unsigned long) p->stats.rss_peak * page_kb,
+	   p->stats.samples);
+}
+
+
 /* if PID or start time are left uninitialized, return false */
 bool proc_eq (const struct proc * const p1, const struct proc * const p2)
 {
-	if (p1->pid == p2->pid && p1->t0 == p2->t0)
+	if (p1->pid == p2->pid && p1->t0 == p2->t0) {
 		return true;
-	else
+	} else {
+		PROBE3(mismatch, p1->pid, p1->t0, p2->t0);
 		return false;
+	}
 }
 
 
@@ -5,16 +5,41 @@
 #define PW_PROC_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "queue.h"
 
 #define STAT_COL_LEN 32
 
-/* represents the process PID. Content is parsed from file /proc/PID/stat */
+/* the kernel truncates process names to TASK_COMM_LEN (16) bytes including
+ * the terminating '\0' */
+#define PNAME_LEN 16
+
+/* resource usage of a process as of its latest sample. Kept in the units of
+ * /proc/PID/stat to keep the record small */
+struct proc_stats {
+	uint64_t utime;		/* user time, clock ticks */
+	uint64_t stime;		/* system time, clock ticks */
+	uint32_t rss;		/* resident set size, pages */
+	uint32_t rss_peak;	/* largest rss seen, pages */
+	uint32_t samples;	/* number of successful stat reads */
+	uint32_t threads;	/* number of threads in the process */
+};
+
+/* represents the process PID. Content is parsed from file /proc/PID/stat,
+ * or from /proc/TGID/task/PID/stat for a thread PID of process TGID. One is
+ * allocated per tracked process, so it is kept at 80 bytes; what only some
+ * modes need is kept in tables of their own */
 struct proc {
 	unsigned pid;
-	char name[STAT_COL_LEN];
-	unsigned t0;
+	unsigned tgid;		/* process of a thread, 0 if not a thread */
+	uint64_t t0;		/* start time, clock ticks after boot */
+	char name[PNAME_LEN];
+	uint32_t text;		/* size of the program text, endcode -
+				 * startcode. Changes with the program, unlike
+				 * the addresses under ASLR. 0 if hidden */
+	struct proc_stats stats;
 	SLIST_ENTRY(proc) procs;
 };
 
@@ -23,9 +48,29 @@ SLIST_HEAD(proclist, proc);
 /* read stat file identified by path and parse it to p */
 int parse_stat_file (const char * path, struct proc * p);
 
+/* parse stat file contents from file to p. path is only used in messages */
+int parse_stat_stream (FILE * file, const char * path, struct proc * p);
+
 /* read stat file identified by PID and parse it to p */
 int parse_stat_pid (const unsigned pid, struct proc * restrict p);
 
+/* read stat file of thread tid of process tgid and parse it to p */
+int parse_stat_task (const unsigned tgid, const unsigned tid,
+		     struct proc * restrict p);
+
+/* read a new sample of the process or thread p to sample */
+int proc_sample (const struct proc * const p, struct proc * sample);
+
+/* find the process tgid which thread tid belongs to */
+int proc_tgid (const unsigned tid, unsigned * restrict tgid);
+
+/* update the usage record of p from a newer sample of the same process */
+void proc_add_sample (struct proc * restrict p,
+		      const struct proc * restrict sample);
+
+/* report a terminated process with its lifetime and usage record */
+void proc_report (const struct proc * const p);
+
 /*  check if p1 and p2 are the same process */
 bool proc_eq (const struct proc * const p1, const struct proc * const p2);
 
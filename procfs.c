@@ -0,0 +1,59 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "error.h"
+#include "procfs.h"
+
+static const char * root = PROCFS_DEFAULT_ROOT;
+static size_t root_len = sizeof(PROCFS_DEFAULT_ROOT) - 1;
+
+
+void procfs_set_root (const char * const r)
+{
+	root = r;
+	root_len = strlen(r);
+
+	/* "/proc/" and "/proc" are the same root */
+	while (root_len > 1 && root[root_len-1] == '/')
+		--root_len;
+}
+
+
+const char * procfs_root (void)
+{
+	return root;
+}
+
+
+bool procfs_is_default (void)
+{
+	return root_len == sizeof(PROCFS_DEFAULT_ROOT) - 1 &&
+	       !memcmp(root, PROCFS_DEFAULT_ROOT, root_len);
+}
+
+
+int procfs_path (char * buf, const size_t len, const char * fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (root_len + 1 >= len)
+		return E_FAIL;
+
+	memcpy(buf, root, root_len);
+	buf[root_len] = '/';
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf + root_len + 1, len - root_len - 1, fmt, ap);
+	va_end(ap);
+
+	if (n < 0 || (size_t) n >= len - root_len - 1)
+		return E_FAIL;
+
+	return E_SUCCESS;
+}
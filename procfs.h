@@ -0,0 +1,33 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Location of the proc filesystem. All paths below /proc are built with
+ * procfs_path() so that procwait can be pointed at another tree, such as a
+ * synthetic one made with procgen. */
+
+#ifndef PW_PROCFS_H
+#define PW_PROCFS_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PROCFS_DEFAULT_ROOT "/proc"
+
+/* buffer size for paths built with procfs_path() */
+#define PROCFS_PATH_LEN PATH_MAX
+
+/* set the proc filesystem root. root is not copied */
+void procfs_set_root (const char * const root);
+
+/* get the proc filesystem root */
+const char * procfs_root (void);
+
+/* check if the root is the kernel's /proc, trailing slashes ignored */
+bool procfs_is_default (void);
+
+/* format a path relative to the proc filesystem root to buf. Returns E_FAIL
+ * if the path did not fit in len bytes */
+int procfs_path (char * buf, const size_t len, const char * fmt, ...);
+
+#endif /* PW_PROCFS_H */
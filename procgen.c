@@ -0,0 +1,247 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* procgen: build a synthetic proc tree for testing and benchmarking procwait
+ * with --proc-root.
+ *
+ * Usage: procgen DIR N [SCRIPT]
+ *
+ * Creates DIR/PID/stat for PIDs 1..N. Processes are named taskNN where NN is
+ * PID modulo 100. If SCRIPT is given (- for stdin) it is then run line by
+ * line. Each line is
+ *
+ *     DELAY_MS ACTION PID[-PID]
+ *
+ * where ACTION is one of
+ *
+ *     exit	remove the process
+ *     reuse	replace the process with a new one with the same PID and name
+ *		but a later start time
+ *     spawn	create a new process
+ *
+ * DELAY_MS is relative to the previous line. Empty lines and lines starting
+ * with '#' are skipped. After each action procgen prints a line
+ * "MONO_NS ACTION PID" with the CLOCK_MONOTONIC time the action completed. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGNAME "procgen"
+#define PATH_LEN 4096
+#define LINE_LEN 256
+
+/* start time of PID in generation gen. Later generations start later. The
+ * start times don't fit in 32 bits, as on hosts with a long uptime */
+#define START_TIME(pid, gen) (5000000000ULL + (pid) + (gen) * 100000000ULL)
+
+static const char *root;
+
+
+static unsigned long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000 +
+	       (unsigned long long) ts.tv_nsec;
+}
+
+
+static void sleep_ms (const unsigned long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t) (ms / 1000);
+	ts.tv_nsec = (long) (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+
+/* write the stat file of pid. The file is written next to its final name and
+ * renamed in place, so a reader never sees a partial file */
+static int write_stat (const unsigned pid, const unsigned gen)
+{
+	char dir[PATH_LEN], path[PATH_LEN], tmp[PATH_LEN];
+	FILE *f;
+
+	snprintf(dir, PATH_LEN, "%s/%u", root, pid);
+	snprintf(path, PATH_LEN, "%s/%u/stat", root, pid);
+	snprintf(tmp, PATH_LEN, "%s/%u/.stat.tmp", root, pid);
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		perror(tmp);
+		return -1;
+	}
+
+	fprintf(f, "%u (task%02u) S 1 %u %u 0 -1 4194560 120 0 0 0 "
+		   "%u %u 0 0 20 0 1 0 %llu 4505600 %u 18446744073709551615 "
+		   "94000000000000 94000000100000 140700000000000 0 0 0 0 0 0 "
+		   "0 0 0 17 %u 0 0 0 0 0 94000000200000 94000000300000 "
+		   "94000000400000 140700000100000 140700000100100 "
+		   "140700000100100 140700000100200 0\n",
+		pid, pid % 100, pid, pid, pid % 7, pid % 3,
+		START_TIME(pid, gen), 100 + pid % 1000, pid % 64);
+
+	if (fclose(f) != 0 || rename(tmp, path) == -1) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int remove_proc (const unsigned pid)
+{
+	char dir[PATH_LEN], path[PATH_LEN];
+
+	snprintf(dir, PATH_LEN, "%s/%u", root, pid);
+	snprintf(path, PATH_LEN, "%s/%u/stat", root, pid);
+
+	if (unlink(path) == -1 || rmdir(dir) == -1) {
+		perror(dir);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* generation of a pid is kept in a growing array, indexed by pid */
+static unsigned *gens = NULL;
+static size_t gens_len = 0;
+
+static unsigned *gen_of (const unsigned pid)
+{
+	if (pid >= gens_len) {
+		size_t len = gens_len ? gens_len : 1024;
+		unsigned *tmp;
+
+		while (len <= pid)
+			len *= 2;
+		tmp = realloc(gens, len * sizeof(*gens));
+		if (tmp == NULL) {
+			perror(PROGNAME);
+			exit(1);
+		}
+		memset(tmp + gens_len, 0, (len - gens_len) * sizeof(*gens));
+		gens = tmp;
+		gens_len = len;
+	}
+
+	return &gens[pid];
+}
+
+
+static int run_action (const char * const action, const unsigned pid)
+{
+	int ret;
+
+	if (!strcmp(action, "exit")) {
+		ret = remove_proc(pid);
+	} else if (!strcmp(action, "reuse")) {
+		ret = write_stat(pid, ++*gen_of(pid));
+	} else if (!strcmp(action, "spawn")) {
+		ret = write_stat(pid, *gen_of(pid));
+	} else {
+		fprintf(stderr, "%s: unknown action '%s'\n", PROGNAME, action);
+		return -1;
+	}
+
+	if (ret == 0)
+		printf("%llu %s %u\n", now_ns(), action, pid);
+
+	return ret;
+}
+
+
+static int run_script (FILE * const script)
+{
+	char line[LINE_LEN];
+	unsigned lineno = 0;
+
+	while (fgets(line, LINE_LEN, script) != NULL) {
+		unsigned long delay;
+		char action[16];
+		unsigned first, last;
+		int n;
+
+		++lineno;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		n = sscanf(line, "%lu %15s %u-%u", &delay, action, &first,
+			   &last);
+		if (n < 3) {
+			fprintf(stderr, "%s: invalid script line %u\n",
+				PROGNAME, lineno);
+			return -1;
+		}
+		if (n == 3)
+			last = first;
+
+		sleep_ms(delay);
+		for (unsigned pid = first; pid <= last; ++pid) {
+			if (run_action(action, pid) != 0)
+				return -1;
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+
+int main (int argc, char **argv)
+{
+	unsigned long n;
+	FILE *script = NULL;
+	int ret = 0;
+
+	if (argc < 3 || argc > 4) {
+		fprintf(stderr, "Usage: %s DIR N [SCRIPT]\n", PROGNAME);
+		return 1;
+	}
+
+	root = argv[1];
+	n = strtoul(argv[2], NULL, 10);
+
+	if (argc == 4) {
+		script = strcmp(argv[3], "-") ? fopen(argv[3], "r") : stdin;
+		if (script == NULL) {
+			perror(argv[3]);
+			return 1;
+		}
+	}
+
+	if (mkdir(root, 0755) == -1 && errno != EEXIST) {
+		perror(root);
+		return 1;
+	}
+
+	for (unsigned pid = 1; pid <= n; ++pid) {
+		if (write_stat(pid, 0) != 0)
+			return 1;
+	}
+
+	if (script != NULL) {
+		ret = run_script(script);
+		if (script != stdin)
+			fclose(script);
+	}
+
+	free(gens);
+	return ret == 0 ? 0 : 1;
+}
@@ -7,19 +7,150 @@ procwait \- wait for process to terminate
 .SH DESCRIPTION
 \fBprocwait\fP allows to wait until a process or (processes) identified by PID
 is terminated.
+.PP
+The processes are sampled from \fI/proc/PID/stat\fP on every check. When a
+process terminates its lifetime, user and system CPU time, and resident set
+size (last and peak) as of the last sample are printed.
 .SH OPTIONS
 .TP
+\fB--file \fIPATH\fP
+Wait until no process has \fIPATH\fP open. Can be given multiple times.
+Files are matched by device and inode. When \fIPATH\fP is a mount point,
+any file on the mounted file system matches, as with \fBfuser -m\fP. A
+working directory, root directory or executable holds a file like an open
+descriptor does. The processes having the file open
+are found with one parallel scan of the open file descriptors of all
+processes; after that only those processes and processes started after the
+previous check are scanned. A process which was running at the start
+without the file open and opens it later is not noticed. Scanning processes
+of other users needs privileges; procwait warns once about the processes it
+could not scan, as they may hold the file unnoticed.
+.TP
+\fB--format \fItext\fP|\fIjson\fP
+Output format. In \fIjson\fP format every event (\fIstart\fP, \fIwaiting\fP,
+\fInot-running\fP, \fIterminated\fP, \fIexec\fP, \fIthreads-below\fP,
+\fIgroup-done\fP, \fIgroup-command\fP, \fIlatency\fP,
+\fIport-owner\fP, \fIport-released\fP, \fIpressure-above\fP,
+\fIpressure-below\fP, \fIwarning\fP, \fIerror\fP and
+\fIstats\fP) is printed to stdout as a JSON object on a line of its own, with
+the wall clock and monotonic time in nanoseconds in \fItime_ns\fP and
+\fImono_ns\fP. Output is buffered and written once per process check round.
+.TP
+\fB--group \fINAME\fB:\fIMEMBER\fR,...[\fB:\fICOMMAND\fR]
+Wait for a group of processes, where each \fIMEMBER\fP is a PID or
+\fBn=\fIPNAME\fR for the processes called \fIPNAME\fP. When the last member
+of the group has terminated, the completion of group \fINAME\fP is reported
+and \fICOMMAND\fP, if given, is run with \fB/bin/sh -c\fP and
+\fBPROCWAIT_GROUP\fP set to \fINAME\fP. Can be given up to 64 times. All
+groups share one table of processes checked on one sweep, and a process in
+many groups is checked once. procwait waits for the commands to exit before
+exiting itself.
+.TP
 \fB-h\fP, \fB--help\fP
 Shows brief help and exits.
 .TP
+\fB--journal \fIFILE\fP
+Append events (start, waiting for a process, process not running, process
+terminated, done) to a binary journal in \fIFILE\fP. The journal is a memory
+mapped ring buffer of the latest 65536 events, so logging costs no system
+calls and the events survive procwait being killed. An existing journal is
+appended to. A file which is not empty and is not a journal is left
+untouched, and procwait exits with an error. Print the journal with \fBpwjournal\fP \fIFILE\fP.
+.TP
+\fB--latency \fIINTERVAL\fR[\fB/\fIBUDGET\fR]
+Detect the exits of the tracked processes with low latency. Each process is
+watched through a pidfd, which wakes procwait as soon as the process exits,
+or where pidfds are not available (threads, older kernels) through its stat
+file kept open, which is read every \fIINTERVAL\fP microseconds (or with a
+\fBus\fP, \fBms\fP or \fBs\fP suffix; 0 spins). The short polling goes on
+only while procwait has used less than \fIBUDGET\fP percent (default 10) of
+a CPU within the current sleep interval (\fB-s\fP), after which it sleeps
+until the interval ends. The processes are sampled in full, and files and
+ports checked, once per sleep interval. A process is detected as
+terminated when it exits, even if its parent has not reaped it yet. The
+achieved latency and the CPU time used are reported at exit.
+.TP
 \fB-n \fINAME\fP, \fB--name \fINAME\fP
 Parse PID from process NAME.
 .TP
+\fB--pidns \fIPID\fR|\fIPATH\fP
+The \fIPID\fP arguments are PIDs in the PID namespace of process \fIPID\fP or
+of the namespace file \fIPATH\fP, such as \fI/proc/PID/ns/pid\fP. A single
+argument can name its own namespace as \fIPID\fB@\fIPID\fR|\fIPATH\fR
+instead. The PIDs are translated to PIDs of procwait's namespace once at
+the start, from the last \fBNSpid\fP entry of \fI/proc/PID/status\fP. Only
+processes whose own PID namespace is the given one are read, which leaves
+out processes in namespaces nested inside it. Reading the namespaces of
+processes of other users needs privileges.
+.TP
+\fB--port \fIPORT\fP
+Wait until no TCP socket is listening and no UDP socket is bound on
+\fIPORT\fP. Can be given multiple times. The sockets are read from
+\fI/proc/net/tcp\fP, \fItcp6\fP, \fIudp\fP and \fIudp6\fP on every check.
+Their owners are found by scanning the open file descriptors of all processes
+when sockets appear that were not there on the previous check, and their
+termination is reported. Only sockets in the network namespace of procwait
+are seen, and finding the owners among processes of other users needs
+privileges.
+.TP
+\fB--pressure \fIRESOURCE\fB:\fITHRESHOLD\fB/\fIWINDOW\fP
+Wait until the pressure stall information of \fIRESOURCE\fP (\fIcpu\fP,
+\fImemory\fP or \fIio\fP) stays calm: some tasks were stalled on the
+resource for less than \fITHRESHOLD\fP per \fIWINDOW\fP for two full
+windows, as told by both the trigger and the stall time counter. The times
+are microseconds or have a \fIus\fP, \fIms\fP or \fIs\fP suffix. Can be
+given multiple times. procwait exits when all conditions are met and the
+given processes and files are done. A kernel trigger is registered on
+\fI/proc/pressure/RESOURCE\fP, so procwait sleeps until the trigger fires or
+the window passes instead of polling. The kernel limits the window to 500ms
+\(en 10s, and without \fBCAP_SYS_RESOURCE\fP to multiples of 2s.
+.TP
+\fB--proc-root \fIDIR\fP
+Read process information from \fIDIR\fP instead of \fI/proc\fP. Useful with
+synthetic proc trees built with \fBprocgen\fP for testing and benchmarking.
+.TP
 \fB-q\fP, \fB--quiet\fP
 Only print essential output and errors.
 .TP
-\fB-s\fP \fINUM\fP[ms], \fB--sleep\fP \fINUM\fP[ms]
-Seconds (milliseconds) to sleep between process checks.
+\fB-s\fP \fINUM\fP[s|ms|us], \fB--sleep\fP \fINUM\fP[s|ms|us]
+Seconds (milliseconds, microseconds) to sleep between process checks.
+.TP
+\fB--state \fIFILE\fP
+Keep a checkpoint of the tracked processes (PID, start time and name) in
+\fIFILE\fP. On start the processes in \fIFILE\fP which are still running
+with the same start time are waited for in addition to the given ones, so a
+restarted procwait resumes where the previous one left off without following
+reused PIDs. Nothing is resumed from a file written before the latest
+reboot. The file is rewritten atomically at most once a second when
+processes terminate, and removed when all processes have terminated.
+.TP
+\fB--stats\fP
+Collect statistics about procwait itself: loop passes, process checks, files
+opened, bytes read, and histograms of the scan time, the time of a single
+process check and the estimated delay between a termination and its
+detection. The statistics are printed on exit and when \fBSIGUSR1\fP is
+received.
+.TP
+\fB--threads-below \fIN\fP
+Stop waiting for a process when it has fewer than \fIN\fP threads, as
+reported by the num_threads field of its stat file. Does not apply to
+threads given with \fB--tid\fP.
+.TP
+\fB--tid \fITID\fP
+Wait for the thread \fITID\fP to terminate. The thread is sampled from
+\fI/proc/PID/task/TID/stat\fP of its process and identified by its start
+time like processes are. Can be given multiple times.
+.TP
+\fB--until-exec\fP
+Stop waiting for a process when it executes a different program, e.g. when a
+wrapper script executes its payload. Exec events are read from the kernel
+process event connector when it is available. The executable (device and
+inode of \fI/proc/PID/exe\fP) captured at start is compared after an exec
+event, so no extra files are read while the process keeps running its
+program. Without the connector it is compared only when the process name
+or the size of the program text in \fI/proc/PID/stat\fP changes. Executing
+the same program again does not count. When
+\fI/proc/PID/exe\fP can't be read, the process name is compared instead.
 .TP
 \fB-V\fP, \fB--version\fP
 Shows program version and exits.
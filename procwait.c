@@ -1,7 +1,13 @@
 /* Copyright 2013-2017 Tuomo Hartikainen <tth@harski.org>.
  * Licensed under the 2-clause BSD license, see LICENSE for details. */
 
+/* for ppoll() */
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +15,22 @@
 #include <unistd.h>
 
 #include "error.h"
+#include "execwatch.h"
 #include "fileutil.h"
+#include "filewait.h"
 #include "go.h"
+#include "group.h"
+#include "journal.h"
+#include "latency.h"
+#include "pidns.h"
+#include "portwait.h"
+#include "probes.h"
 #include "proc.h"
+#include "procfs.h"
+#include "psi.h"
 #include "queue.h"
+#include "state.h"
+#include "stats.h"
 #include "strutil.h"
 
 #define PROGNAME "procwait"
@@ -28,11 +46,42 @@
 #define DEFAULT_SLEEP_SEC 1
 #define DEFAULT_SLEEP_NSEC 0
 
+/* minimum time between state file writes */
+#define STATE_SAVE_INTERVAL_SEC 1
+
 struct options {
 	int action;		/* selected action */
 	struct timespec sleep;	/* time to sleep between polls (PID stats) */
+	bool stats;		/* collect and print statistics */
+	const char *journal;	/* path of the event journal, or NULL */
+	const char *state;	/* path of the state file, or NULL */
+	unsigned threads_below;	/* stop waiting for a process with fewer
+				 * threads, 0 to wait for it to terminate */
+	bool until_exec;	/* stop waiting for a process on exec */
+	const char *pidns;	/* PID namespace of the PID arguments, or NULL */
 };
 
+/* values for long options without a short option */
+enum {
+	OPT_STATS = 256,
+	OPT_JOURNAL,
+	OPT_FORMAT,
+	OPT_PROC_ROOT,
+	OPT_STATE,
+	OPT_FILE,
+	OPT_PRESSURE,
+	OPT_TID,
+	OPT_THREADS_BELOW,
+	OPT_UNTIL_EXEC,
+	OPT_PORT,
+	OPT_GROUP,
+	OPT_PIDNS,
+	OPT_LATENCY
+};
+
+/* set by SIGUSR1 when statistics should be printed */
+static volatile sig_atomic_t stats_requested = 0;
+
 /* available actions */
 enum {
 	A_PROCWAIT,
@@ -43,14 +92,29 @@ enum {
 static int do_action (const struct options * const opt,
 		      struct proclist * restrict proclist);
 static inline void clear_pidlist(struct proclist * restrict proclist);
+static int dedupe_pidlist (struct proclist * restrict proclist);
 static void load_default_opts (struct options * restrict opt);
 static int parse_name_to_proc(struct filelist *fl, const char * const str,
 			      struct proclist * restrict proclist);
 static int parse_options (int argc, char **argv, struct options * restrict opt,
 			  struct proclist * restrict proclist);
+static int parse_pid_to_proc (const char * const arg,
+			      const char * const pidns,
+			      struct proclist * restrict proclist);
+static int parse_tid_to_proc (const unsigned tid,
+			      struct proclist * restrict proclist);
 static int parse_sleep_time (const char * const timestr,
 			     struct timespec * restrict ts);
 static void print_help ();
+static void report_exec (const struct proc * const proc,
+			 const struct proc * const sample);
+static void report_threads (const struct proc * const proc,
+			    const struct proc * const sample);
+static void report_waiting (const struct proc * const proc);
+static void request_stats (int sig);
+static void wait_tick (const struct options * const opt, const bool polling);
+static void save_state (const char * const path,
+			const struct proclist * proclist);
 static int procwait (const struct options * const opt,
 		     struct proclist * restrict proclist);
 
@@ -115,11 +179,90 @@ static inline void clear_pidlist(struct proclist * restrict proclist)
 }
 
 
+struct listed_proc {
+	struct proc *proc;
+	size_t pos;		/* position on the list */
+};
+
+
+static int cmp_listed_proc (const void *a, const void *b)
+{
+	const struct listed_proc *la = a, *lb = b;
+	const struct proc *pa = la->proc, *pb = lb->proc;
+
+	if (pa->pid != pb->pid)
+		return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+	if (pa->tgid != pb->tgid)
+		return (pa->tgid > pb->tgid) - (pa->tgid < pb->tgid);
+	return (la->pos > lb->pos) - (la->pos < lb->pos);
+}
+
+
+/* drop the later entries of processes listed more than once, e.g. as a group
+ * member and as an argument, keeping the order of the list */
+static int dedupe_pidlist (struct proclist * restrict proclist)
+{
+	struct listed_proc *sorted;
+	struct proc *proc, **listed;
+	size_t n = 0, pos = 0;
+
+	SLIST_FOREACH(proc, proclist, procs)
+		++n;
+	if (n < 2)
+		return E_SUCCESS;
+
+	sorted = malloc(n * sizeof(*sorted));
+	listed = malloc(n * sizeof(*listed));
+	if (sorted == NULL || listed == NULL) {
+		go(GO_ERR, "Could not allocate memory for the process list\n");
+		free(sorted);
+		free(listed);
+		return E_FAIL;
+	}
+
+	SLIST_FOREACH(proc, proclist, procs) {
+		sorted[pos].proc = proc;
+		sorted[pos].pos = pos;
+		listed[pos] = proc;
+		++pos;
+	}
+
+	qsort(sorted, n, sizeof(*sorted), cmp_listed_proc);
+	for (size_t i = 1; i < n; ++i) {
+		const struct proc *prev = sorted[i - 1].proc;
+
+		proc = sorted[i].proc;
+		if (proc->pid == prev->pid && proc->tgid == prev->tgid)
+			listed[sorted[i].pos] = NULL;
+	}
+
+	SLIST_INIT(proclist);
+	for (size_t i = n; i-- > 0; ) {
+		if (listed[i] != NULL)
+			SLIST_INSERT_HEAD(proclist, listed[i], procs);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		if (listed[sorted[i].pos] == NULL)
+			free(sorted[i].proc);
+	}
+
+	free(sorted);
+	free(listed);
+	return E_SUCCESS;
+}
+
+
 static void load_default_opts (struct options * restrict opt)
 {
 	opt->action = A_PROCWAIT;
 	opt->sleep.tv_sec = DEFAULT_SLEEP_SEC;
 	opt->sleep.tv_nsec = DEFAULT_SLEEP_NSEC;
+	opt->stats = false;
+	opt->journal = NULL;
+	opt->state = NULL;
+	opt->threads_below = 0;
+	opt->until_exec = false;
+	opt->pidns = NULL;
 	go_set_lvl(GO_NORMAL);
 
 #if DEBUG
@@ -148,23 +291,50 @@ static int parse_options (int argc, char **argv, struct options * restrict opt,
 {
 	int retval = E_SUCCESS;
 
-	/* temproray list of all running processes. used for matching a process
-	 * name to its PID. the list is initialized only if --name argument is
-	 * set. */
-	struct filelist fl;
-	bool fl_init = false;
+	/* process names given with --name. They are matched to PIDs only
+	 * after all options are parsed, as the matching depends on options
+	 * such as --proc-root. */
+	const char **names = malloc(sizeof(char *) * (size_t) argc);
+	int name_cnt = 0;
+
+	/* thread IDs given with --tid, resolved to their processes likewise */
+	unsigned *tids = malloc(sizeof(unsigned) * (size_t) argc);
+	int tid_cnt = 0;
+
+	if (names == NULL || tids == NULL) {
+		go(GO_ERR, "Could not allocate memory for process names\n");
+		free(names);
+		free(tids);
+		return E_FAIL;
+	}
 
 	/* temp values for argv validation */
 	unsigned tmpu;
+	struct filelist fl;
 
 	while (!retval) {
 		int option;
 		int option_index = 0;
 		static struct option long_options[] = {
+			{"file",	required_argument,	0, OPT_FILE},
+			{"format",	required_argument,	0, OPT_FORMAT},
+			{"group",	required_argument,	0, OPT_GROUP},
 			{"help",	no_argument,		0, 'h'},
+			{"journal",	required_argument,	0, OPT_JOURNAL},
+			{"latency",	required_argument,	0, OPT_LATENCY},
 			{"name",	required_argument,	0, 'n'},
+			{"pidns",	required_argument,	0, OPT_PIDNS},
+			{"port",	required_argument,	0, OPT_PORT},
+			{"pressure",	required_argument,	0, OPT_PRESSURE},
+			{"proc-root",	required_argument,	0, OPT_PROC_ROOT},
 			{"quiet",	no_argument,		0, 'q'},
 			{"sleep",	required_argument,	0, 's'},
+			{"state",	required_argument,	0, OPT_STATE},
+			{"stats",	no_argument,		0, OPT_STATS},
+			{"threads-below", required_argument,	0,
+							OPT_THREADS_BELOW},
+			{"tid",		required_argument,	0, OPT_TID},
+			{"until-exec",	no_argument,		0, OPT_UNTIL_EXEC},
 			{"verbose",	no_argument,		0, 'v'},
 			{"version",	no_argument,		0, 'V'},
 			{0,		0,			0,  0 }
@@ -176,17 +346,55 @@ static int parse_options (int argc, char **argv, struct options * restrict opt,
 			break;
 
 		switch (option) {
+		case OPT_FILE:
+			if (filewait_add(optarg) != E_SUCCESS)
+				retval = E_INVAL;
+			break;
+		case OPT_FORMAT:
+			if (!strcmp(optarg, "text")) {
+				go_set_format(GO_TEXT);
+			} else if (!strcmp(optarg, "json")) {
+				go_set_format(GO_JSON);
+			} else {
+				go(GO_ERR, "Invalid format '%s'\n", optarg);
+				retval = E_INVAL;
+			}
+			break;
+		case OPT_GROUP:
+			retval = group_add(optarg);
+			if (retval == E_INVAL)
+				go(GO_ERR, "Invalid group '%s'\n", optarg);
+			break;
 		case 'h':
 			opt->action = A_HELP;
 			break;
+		case OPT_JOURNAL:
+			opt->journal = optarg;
+			break;
+		case OPT_LATENCY:
+			retval = latency_set(optarg);
+			if (retval == E_INVAL)
+				go(GO_ERR, "Invalid latency '%s'\n", optarg);
+			break;
 		case 'n':
-			/* file list is not initialized, init it */
-			if (!fl_init) {
-				fl_init = true;
-				SLIST_INIT(&fl);
-				get_proc_dirs(&fl);
-			}
-			parse_name_to_proc(&fl, optarg, proclist);
+			names[name_cnt++] = optarg;
+			break;
+		case OPT_PIDNS:
+			opt->pidns = optarg;
+			break;
+		case OPT_PORT:
+			retval = portwait_add(optarg);
+			if (retval == E_INVAL)
+				go(GO_ERR, "Invalid port '%s'\n", optarg);
+			break;
+		case OPT_PRESSURE:
+			retval = psi_add(optarg);
+			if (retval == E_INVAL)
+				go(GO_ERR, "Invalid pressure condition '%s'\n",
+				   optarg);
+			break;
+		case OPT_PROC_ROOT:
+			procfs_set_root(optarg);
 			break;
 		case 'q':
 			go_set_lvl(GO_QUIET);
@@ -199,6 +407,31 @@ static int parse_options (int argc, char **argv, struct options * restrict opt,
 				retval = E_INVAL;
 			}
 			break;
+		case OPT_STATE:
+			opt->state = optarg;
+			break;
+		case OPT_STATS:
+			opt->stats = true;
+			break;
+		case OPT_THREADS_BELOW:
+			if (strtou(optarg, &opt->threads_below) != E_SUCCESS ||
+			    opt->threads_below == 0) {
+				go(GO_ERR, "Invalid thread count '%s'\n",
+				   optarg);
+				retval = E_INVAL;
+			}
+			break;
+		case OPT_TID:
+			if (strtou(optarg, &tmpu) == E_SUCCESS) {
+				tids[tid_cnt++] = tmpu;
+			} else {
+				go(GO_ERR, "Invalid TID '%s'\n", optarg);
+				retval = E_INVAL;
+			}
+			break;
+		case OPT_UNTIL_EXEC:
+			opt->until_exec = true;
+			break;
 		case 'V':
 			opt->action = A_VERSION;
 			break;
@@ -211,40 +444,67 @@ static int parse_options (int argc, char **argv, struct options * restrict opt,
 		}
 	}
 
-	/* free filelist */
-	if (fl_init) {
-		while (!SLIST_EMPTY(&fl)) {
-			struct file *f = SLIST_FIRST(&fl);
-			SLIST_REMOVE_HEAD(&fl, files);
-			file_destroy(f);
-		}
-	}
-
 	/* if argv parsing has already failed or a secondary action has been
 	 * selected PID parsing is not necessary */
 	if (retval == E_INVAL || opt->action != A_PROCWAIT) {
+		free(names);
+		free(tids);
 		return retval;
 	}
 
-	/* check if PID is supplied */
-	while (optind != argc) {
-		if (strtou(argv[optind], &tmpu) == E_SUCCESS) {
-			/* add PID to the list */
-			struct proc * proc = malloc(sizeof(struct proc));
-			if (proc==NULL) {
-				retval = E_FAIL;
-				go(GO_ERR, "Could not allocate memory"
-					   "for struct proc\n");
-				break;
-			}
-			proc->pid = tmpu;
-			SLIST_INSERT_HEAD(proclist, proc, procs);
-		} else {
-			go(GO_ERR, "Invalid PID '%s'\n", argv[optind]);
-			retval = E_INVAL;
+	/* match process names, also those of group members, to PIDs with a
+	 * single listing of all running processes */
+	SLIST_INIT(&fl);
+	if (name_cnt > 0 || group_has_names()) {
+		if (get_proc_dirs(&fl) != E_SUCCESS) {
+			go(GO_ERR, "Could not list processes in '%s'\n",
+			   procfs_root());
+			retval = E_FAIL;
 		}
+	}
+
+	for (int i = 0; i < name_cnt; ++i)
+		parse_name_to_proc(&fl, names[i], proclist);
+	free(names);
+
+	if (retval == E_SUCCESS)
+		retval = group_resolve(&fl, proclist);
+
+	/* free filelist */
+	while (!SLIST_EMPTY(&fl)) {
+		struct file *f = SLIST_FIRST(&fl);
+		SLIST_REMOVE_HEAD(&fl, files);
+		file_destroy(f);
+	}
+
+	for (int i = 0; i < tid_cnt && retval == E_SUCCESS; ++i)
+		retval = parse_tid_to_proc(tids[i], proclist);
+	free(tids);
+
+	/* all PID namespaces must be known before indexing them in one pass
+	 * over the processes */
+	for (int i = optind; i < argc && retval == E_SUCCESS; ++i) {
+		const char *ns = strchr(argv[i], '@');
+
+		ns = ns != NULL ? ns + 1 : opt->pidns;
+		if (ns != NULL)
+			retval = pidns_add(ns, &tmpu);
+	}
+	if (retval == E_SUCCESS && pidns_build() != E_SUCCESS) {
+		go(GO_ERR, "Could not list processes in '%s'\n",
+		   procfs_root());
+		retval = E_FAIL;
+	}
+
+	/* check if PID is supplied */
+	while (optind != argc && retval == E_SUCCESS) {
+		retval = parse_pid_to_proc(argv[optind], opt->pidns, proclist);
 		++optind;
 	}
+	pidns_free();
+
+	if (retval == E_SUCCESS)
+		retval = dedupe_pidlist(proclist);
 
 	/* error was encountered in parsing PID; make sure the pidlist is
 	 * cleared before returning */
@@ -255,27 +515,94 @@ static int parse_options (int argc, char **argv, struct options * restrict opt,
 }
 
 
-static int parse_sleep_time (const char * const str,
-			     struct timespec * restrict ts)
+/* a PID argument is PID or PID@NS for a PID in namespace NS. Without NS it
+ * is in namespace pidns, if that is given */
+static int parse_pid_to_proc (const char * const arg,
+			      const char * const pidns,
+			      struct proclist * restrict proclist)
 {
-	unsigned long tmpul;
-	char *tmpstr;
+	char buf[STAT_COL_LEN];
+	const char *ns = strchr(arg, '@');
+	struct proc *proc;
+	unsigned pid, local, idx;
+
+	if (ns != NULL) {
+		snprintf(buf, STAT_COL_LEN, "%.*s", (int) (ns - arg), arg);
+		++ns;
+	} else {
+		snprintf(buf, STAT_COL_LEN, "%s", arg);
+		ns = pidns;
+	}
+
+	if (strtou(buf, &pid) != E_SUCCESS) {
+		go(GO_ERR, "Invalid PID '%s'\n", arg);
+		return E_INVAL;
+	}
 
-	tmpul = strtoul(str, &tmpstr, 10);
+	if (ns != NULL) {
+		local = pid;
+		if (pidns_add(ns, &idx) != E_SUCCESS)
+			return E_FAIL;
+		if (pidns_lookup(idx, local, &pid) != E_SUCCESS) {
+			go(GO_ERR, "No process %u in PID namespace '%s' was "
+				   "found.\n", local, ns);
+			return E_SUCCESS;
+		}
+		go(GO_INFO, "PID %u in namespace '%s' is PID %u\n", local, ns,
+		   pid);
+	}
 
-	/* if valid ul (sleep time in seconds) */
-	if (*tmpstr == '\0' || !strcmp(tmpstr, "s")) {
-		ts->tv_sec = (time_t) tmpul;
-	} else if (!strcmp(tmpstr, "ms")) {
-		/* get full seconds */
-		ts->tv_sec = tmpul/1000;
-		/* get milliseconds */
-		ts->tv_nsec = 1000000 * (tmpul % 1000);
+	/* add PID to the list */
+	proc = malloc(sizeof(struct proc));
+	if (proc == NULL) {
+		go(GO_ERR, "Could not allocate memory for struct proc\n");
+		return E_FAIL;
+	}
+	proc->pid = pid;
+	proc->tgid = 0;
+	SLIST_INSERT_HEAD(proclist, proc, procs);
 
-	} else {
-		return E_INVAL;
+	return E_SUCCESS;
+}
+
+
+/* threads are tracked through the task directory of their process */
+static int parse_tid_to_proc (const unsigned tid,
+			      struct proclist * restrict proclist)
+{
+	struct proc *proc;
+	unsigned tgid;
+
+	if (proc_tgid(tid, &tgid) != E_SUCCESS) {
+		go(GO_ERR, "No thread %u was found.\n", tid);
+		return E_SUCCESS;
 	}
 
+	proc = malloc(sizeof(struct proc));
+	if (proc == NULL) {
+		go(GO_ERR, "Could not allocate memory for struct proc\n");
+		return E_FAIL;
+	}
+	proc->pid = tid;
+	proc->tgid = tgid;
+	SLIST_INSERT_HEAD(proclist, proc, procs);
+
+	return E_SUCCESS;
+}
+
+
+static int parse_sleep_time (const char * const str,
+			     struct timespec * restrict ts)
+{
+	uint64_t us;
+
+	/* seconds without a unit */
+	if (strtousec(str, 1000000, &us) != E_SUCCESS)
+		return E_INVAL;
+
+	ts->tv_sec = (time_t) (us / 1000000);
+	ts->tv_nsec = (long) (us % 1000000) * 1000;
+
 	return E_SUCCESS;
 }
 
@@ -285,19 +612,72 @@ static void print_help ()
 	go(GO_ESS, "Usage: %s [OPTIONS] PID...\n\n", PROGNAME);
 	go(GO_ESS, "Options:\n");
 
+	go(GO_ESS, "--file PATH\n"
+		   "\tWait until no process has PATH open.\n");
+
+	go(GO_ESS, "--format text|json\n"
+		   "\tPrint events as text (default) or JSON Lines.\n");
+
+	go(GO_ESS, "--group NAME:PID|n=PNAME,...[:COMMAND]\n"
+		   "\tReport when the group's processes have terminated and "
+		   "run COMMAND.\n");
+
 	go(GO_ESS, "-h, --help\n"
 		   "\tPrint this help.\n");
 
+	go(GO_ESS, "--journal FILE\n"
+		   "\tRecord events to a memory mapped journal FILE.\n");
+
+	go(GO_ESS, "--latency INTERVAL[/BUDGET]\n"
+		   "\tDetect exits within INTERVAL microseconds, using at "
+		   "most BUDGET percent\n\tof a CPU (default %u).\n",
+	   LATENCY_BUDGET_DEFAULT);
+
 	go(GO_ESS, "-n NAME, --name NAME\n"
 		   "\tParse PID from process NAME.\n");
 
+	go(GO_ESS, "--pidns PID|PATH\n"
+		   "\tThe PIDs are in the PID namespace of process PID or "
+		   "of the namespace\n\tfile PATH. A single PID can be given "
+		   "as PID@PID|PATH instead.\n");
+
+	go(GO_ESS, "--port PORT\n"
+		   "\tWait until no TCP socket listens and no UDP socket is "
+		   "bound on PORT.\n");
+
+	go(GO_ESS, "--pressure cpu|memory|io:THRESHOLD/WINDOW\n"
+		   "\tWait until tasks stall on the resource for less than "
+		   "THRESHOLD\n\tper WINDOW for a full WINDOW.\n");
+
+	go(GO_ESS, "--proc-root DIR\n"
+		   "\tRead process information from DIR instead of /proc.\n");
+
 	go(GO_ESS, "-q, --quiet\n"
 		   "\tOnly print essential output and errors.\n");
 
-	go(GO_ESS, "-s NUM[ms], --sleep NUM[ms]\n"
-		   "\tSleep NUM seconds (milliseconds) between"
+	go(GO_ESS, "-s NUM[s|ms|us], --sleep NUM[s|ms|us]\n"
+		   "\tSleep NUM seconds (milliseconds, microseconds) between "
 		   "process checks.\n");
 
+	go(GO_ESS, "--state FILE\n"
+		   "\tKeep the tracked processes in FILE and resume "
+		   "waiting for them on restart.\n");
+
+	go(GO_ESS, "--stats\n"
+		   "\tCollect timing statistics and print them on exit "
+		   "or SIGUSR1.\n");
+
+	go(GO_ESS, "--threads-below N\n"
+		   "\tStop waiting for a process when it has fewer than N "
+		   "threads.\n");
+
+	go(GO_ESS, "--tid TID\n"
+		   "\tWait for thread TID to terminate.\n");
+
+	go(GO_ESS, "--until-exec\n"
+		   "\tStop waiting for a process when it executes a different "
+		   "program.\n");
+
 	go(GO_ESS, "-v, --verbose\n"
 		   "\tBe verbose.\n");
 
@@ -306,55 +686,355 @@ static void print_help ()
 }
 
 
+static void report_exec (const struct proc * const proc,
+			 const struct proc * const sample)
+{
+	go(GO_MESS, "Process %u %s executed %s\n", proc->pid, proc->name,
+	   sample->name);
+	go_event_begin(GO_MESS, "exec");
+	go_event_uint("pid", proc->pid);
+	go_event_str("name", proc->name);
+	go_event_uint("t0", proc->t0);
+	go_event_str("new_name", sample->name);
+	go_event_end();
+}
+
+
+static void report_threads (const struct proc * const proc,
+			    const struct proc * const sample)
+{
+	go(GO_MESS, "Process %u %s has %u threads\n", proc->pid, proc->name,
+	   sample->stats.threads);
+	go_event_begin(GO_MESS, "threads-below");
+	go_event_uint("pid", proc->pid);
+	go_event_str("name", proc->name);
+	go_event_uint("t0", proc->t0);
+	go_event_uint("threads", sample->stats.threads);
+	go_event_end();
+}
+
+
+static void report_waiting (const struct proc * const proc)
+{
+	if (proc->tgid != 0)
+		go(GO_MESS, "Waiting for TID %u (%s) of PID %u to terminate\n",
+		   proc->pid, proc->name, proc->tgid);
+	else
+		go(GO_MESS, "Waiting for PID %u (%s) to terminate\n",
+		   proc->pid, proc->name);
+	go_event_begin(GO_MESS, "waiting");
+	go_event_uint("pid", proc->pid);
+	if (proc->tgid != 0)
+		go_event_uint("tgid", proc->tgid);
+	go_event_str("name", proc->name);
+	go_event_uint("t0", proc->t0);
+	go_event_end();
+	journal_log(JE_WAIT, proc->pid, proc->t0, 0);
+}
+
+
+static void request_stats (int sig)
+{
+	(void) sig;
+	stats_requested = 1;
+}
+
+
+static void save_state (const char * const path,
+			const struct proclist * proclist)
+{
+	if (state_save(path, proclist) != E_SUCCESS)
+		go(GO_WARN, "Could not write state file '%s': %s\n", path,
+		   strerror(errno));
+}
+
+
+/* sleep until the next poll of processes and files, or until a pressure
+ * condition may change when only those are left */
+static void wait_tick (const struct options * const opt, const bool polling)
+{
+	struct pollfd psi_fds[PSI_MAX], *fds = psi_fds;
+	struct timespec ts = opt->sleep;
+	uint64_t psi_ns = psi_timeout();
+	size_t nfds, npsi, nlat = 0;
+
+	/* pidfds are polled after the room for the pressure triggers */
+	if (latency_active()) {
+		latency_timeout(&ts);
+		fds = latency_pollfds(PSI_MAX, &nlat);
+		if (fds == NULL)
+			fds = psi_fds;
+	}
+	npsi = psi_pollfds(fds);
+	nfds = nlat > 0 ? PSI_MAX + nlat : npsi;
+
+	if (polling && !latency_active()) {
+		go(GO_INFO, "Sleeping for %u.%06u seconds\n",
+		   (unsigned) opt->sleep.tv_sec,
+		   (unsigned) opt->sleep.tv_nsec / 1000);
+	}
+
+	if (!polling || (psi_ns > 0 &&
+	    psi_ns < (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec)) {
+		ts.tv_sec = (time_t) (psi_ns / 1000000000);
+		ts.tv_nsec = (long) (psi_ns % 1000000000);
+	}
+
+	if (ppoll(fds, nfds, &ts, NULL) > 0) {
+		psi_handle(fds, npsi);
+		if (nlat > 0)
+			latency_handle(fds + PSI_MAX, nlat);
+	}
+}
+
+
 static int procwait (const struct options * const opt,
 		     struct proclist * restrict proclist)
 {
-	struct proc * proc, * tmp_proc;
-
-	/* if list is empty, print help and error out */
-	if (SLIST_EMPTY(proclist)) {
+	struct proc * proc, * tmp_proc, * prev;
+	uint64_t prev_scan;
+	unsigned long tick = 0;
+	bool state_dirty = false;
+	struct timespec state_saved = { 0, 0 };
+
+	/* if there is nothing to wait for and no state to resume, print help
+	 * and error out */
+	if (SLIST_EMPTY(proclist) && opt->state == NULL &&
+	    !filewait_active() && !portwait_active() && !psi_active() &&
+	    !group_active()) {
 		print_help();
 		return E_FAIL;
 	}
 
+	if (opt->stats) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = request_stats;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGUSR1, &sa, NULL);
+		stats_enable();
+	}
+
+	if (opt->journal != NULL) {
+		int retval = journal_open(opt->journal);
+
+		if (retval == E_INVAL) {
+			go(GO_ERR, "'%s' is not a procwait journal\n",
+			   opt->journal);
+			return E_FAIL;
+		} else if (retval != E_SUCCESS) {
+			go(GO_ERR, "Could not open journal '%s': %s\n",
+			   opt->journal, strerror(errno));
+			return E_FAIL;
+		}
+		journal_log(JE_START, (unsigned) getpid(), 0, 0);
+	}
+
+	go_event_begin(GO_MESS, "start");
+	go_event_uint("pid", (unsigned) getpid());
+	go_event_end();
+
 	/* check that processes are running and populate structs */
 	SLIST_FOREACH_SAFE(proc, proclist, procs, tmp_proc) {
-		if (parse_stat_pid(proc->pid, proc) == E_SUCCESS) {
-			go(GO_MESS,
-			   "Waiting for PID %u (%s) to terminate\n",
-			   proc->pid, proc->name);
+		if (proc_sample(proc, proc) == E_SUCCESS) {
+			report_waiting(proc);
 		} else {
 			go(GO_MESS, "Process %u not running\n", proc->pid);
+			go_event_begin(GO_MESS, "not-running");
+			go_event_uint("pid", proc->pid);
+			go_event_end();
+			journal_log(JE_NOT_RUNNING, proc->pid, 0, 0);
 			SLIST_REMOVE(proclist, proc, proc, procs);
+			group_proc_done(proc);
 			free(proc);
 		}
 	}
 
+	group_start();
+
+	/* resume waiting for the processes of an earlier run */
+	if (opt->state != NULL) {
+		struct proclist resumed;
+		unsigned cnt = 0;
+		long saved;
+
+		SLIST_INIT(&resumed);
+		saved = state_load(opt->state, proclist, &resumed);
+		while (!SLIST_EMPTY(&resumed)) {
+			proc = SLIST_FIRST(&resumed);
+			SLIST_REMOVE_HEAD(&resumed, procs);
+			SLIST_INSERT_HEAD(proclist, proc, procs);
+			report_waiting(proc);
+			++cnt;
+		}
+		if (saved >= 0)
+			go(GO_INFO, "Resumed %u of %ld processes from '%s'\n",
+			   cnt, saved, opt->state);
+
+		save_state(opt->state, proclist);
+		clock_gettime(CLOCK_MONOTONIC, &state_saved);
+	}
+
+	if (filewait_start() != E_SUCCESS || portwait_start() != E_SUCCESS ||
+	    psi_start() != E_SUCCESS)
+		return E_FAIL;
+
+	if (opt->until_exec && execwatch_start(proclist) != E_SUCCESS)
+		return E_FAIL;
+
+	if (latency_active() &&
+	    latency_start(proclist, &opt->sleep) != E_SUCCESS)
+		return E_FAIL;
+
+	go_flush();
+
 	/* main wait loop */
-	while (!SLIST_EMPTY(proclist)) {
-		go(GO_INFO, "Sleeping for %u.%03.3u seconds\n",
-		   (unsigned) opt->sleep.tv_sec,
-		   (unsigned) opt->sleep.tv_nsec / 1000000);
-		nanosleep(&opt->sleep, NULL);
+	prev_scan = stats_clock();
+	while (!SLIST_EMPTY(proclist) || !filewait_done() ||
+	       !portwait_done() || !psi_done()) {
+		uint64_t scan_start;
+		bool full;
+
+		wait_tick(opt, !SLIST_EMPTY(proclist) || !filewait_done() ||
+			  !portwait_done());
+
+		if (stats_requested) {
+			stats_requested = 0;
+			stats_dump();
+		}
+
+		scan_start = stats_clock();
+		stats_count(SC_TICKS, 1);
+		++tick;
+		PROBE1(tick__start, tick);
+
+		/* between full checks only the cheap signals are checked */
+		full = !latency_active() || latency_tick();
+
+		if (opt->until_exec)
+			execwatch_tick();
 
 		/* Check all processes still being tracked, and drop the
-		 * terminated ones from proclist */
+		 * finished ones from proclist. The previous process is kept
+		 * for unlinking without walking the list again */
+		prev = NULL;
 		SLIST_FOREACH_SAFE(proc, proclist, procs, tmp_proc) {
 			/* read current stat file of PID */
-			struct proc tmp = { 0, "", 0, {NULL}};
+			struct proc tmp = { .pid = 0 };
+			uint64_t check_start = stats_clock();
+			uint64_t check_end;
+			enum LATENCY_CHECK lc = LC_SAMPLE;
+			bool alive;
+
+			PROBE2(check, proc->pid, proc->t0);
+			if (latency_active())
+				lc = latency_check(proc);
 
 			/* Check that stat could be read and the process is
 			 * still the same. If not, drop it */
-			if (parse_stat_pid(proc->pid, &tmp) ||
-			    !proc_eq(proc, &tmp)) {
-				SLIST_REMOVE(proclist,
-					     proc, proc, procs);
-				go(GO_MESS, "Process %u %s terminated\n",
-				   proc->pid, proc->name);
-				free(proc);
+			if (lc == LC_GONE) {
+				alive = false;
+			} else if (lc == LC_ALIVE && !full) {
+				prev = proc;
+				continue;
+			} else {
+				alive = proc_sample(proc, &tmp) == E_SUCCESS &&
+					proc_eq(proc, &tmp);
+			}
+
+			check_end = stats_clock();
+			stats_count(SC_CHECKS, 1);
+			stats_record(SH_PARSE, check_end - check_start);
+
+			if (!alive) {
+				PROBE2(terminated, proc->pid, proc->t0);
+				journal_log(JE_TERMINATED, proc->pid, proc->t0,
+					    tick);
+				proc_report(proc);
+
+				/* the process terminated at an unknown point
+				 * between its previous check and this one, so
+				 * on average half a tick ago */
+				stats_count(SC_EXITS, 1);
+				if (latency_active())
+					stats_record(SH_LATENCY,
+						     latency_detected(proc));
+				else
+					stats_record(SH_LATENCY,
+						     (scan_start - prev_scan) /
+						     2 + check_end -
+						     check_start);
+			} else if (opt->until_exec &&
+				   execwatch_check(proc, &tmp)) {
+				report_exec(proc, &tmp);
+				journal_log(JE_EXEC, proc->pid, proc->t0, tick);
+			} else if (proc->tgid == 0 && opt->threads_below != 0 &&
+				   tmp.stats.threads < opt->threads_below) {
+				report_threads(proc, &tmp);
+				journal_log(JE_THREADS, proc->pid, proc->t0,
+					    tick);
+			} else {
+				proc_add_sample(proc, &tmp);
+				prev = proc;
+				continue;
+			}
+
+			if (prev == NULL)
+				SLIST_REMOVE_HEAD(proclist, procs);
+			else
+				SLIST_REMOVE_AFTER(prev, procs);
+			group_proc_done(proc);
+			if (latency_active())
+				latency_proc_done(proc);
+			free(proc);
+			state_dirty = true;
+		}
+
+		if (full && !filewait_done())
+			filewait_tick();
+
+		if (full && !portwait_done())
+			portwait_tick();
+
+		group_reap(false);
+
+		stats_record(SH_SCAN, stats_clock() - scan_start);
+		PROBE1(tick__end, tick);
+		go_flush();
+		prev_scan = scan_start;
+
+		/* the saved state may lag behind, it is verified on load */
+		if (state_dirty && opt->state != NULL) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec - state_saved.tv_sec >=
+			    STATE_SAVE_INTERVAL_SEC) {
+				save_state(opt->state, proclist);
+				state_saved = now;
+				state_dirty = false;
 			}
 		}
 	}
 
+	/* nothing is left to resume */
+	if (opt->state != NULL)
+		unlink(opt->state);
+
+	if (opt->until_exec)
+		execwatch_stop();
+
+	if (latency_active())
+		latency_stop();
+
+	group_reap(true);
+
+	journal_log(JE_DONE, (unsigned) getpid(), 0, tick);
+	journal_close();
+
+	if (opt->stats)
+		stats_dump();
+
 	return E_SUCCESS;
 }
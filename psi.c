@@ -0,0 +1,296 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "go.h"
+#include "procfs.h"
+#include "psi.h"
+#include "strutil.h"
+
+#define PSI_TRIGGER_LEN 64
+#define PSI_LINE_LEN 128
+
+/* The kernel sends at most one event per window, and the next one may come
+ * a little after the window has passed. A condition is only considered met
+ * after this many windows without events */
+#define PSI_CALM_WINDOWS 2
+
+static const char * const resources[] = { "cpu", "memory", "io" };
+
+struct psi_cond {
+	const char *res;	/* cpu, memory or io */
+	uint64_t threshold;	/* us */
+	uint64_t window;	/* us */
+	int fd;
+	uint64_t fired;		/* monotonic ns of the latest event */
+	uint64_t total;		/* stall time, us, at fired */
+	bool calm;		/* reported state */
+};
+
+static struct psi_cond conds[PSI_MAX];
+static size_t nconds = 0;
+
+
+static uint64_t now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+/* read the total stall time of some tasks on c->res in us */
+static int read_total (const struct psi_cond * const c,
+		       uint64_t * restrict total)
+{
+	char path[PROCFS_PATH_LEN], line[PSI_LINE_LEN];
+	const char *p;
+	FILE *file;
+	int retval = E_FAIL;
+
+	if (procfs_path(path, PROCFS_PATH_LEN, "pressure/%s", c->res)
+	    != E_SUCCESS)
+		return E_FAIL;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return E_FAIL;
+
+	/* some avg10=0.00 avg60=0.00 avg300=0.00 total=12345 */
+	if (fgets(line, PSI_LINE_LEN, file) != NULL &&
+	    !strncmp(line, "some ", 5) &&
+	    (p = strstr(line, "total=")) != NULL) {
+		*total = strtoull(p + 6, NULL, 10);
+		retval = E_SUCCESS;
+	}
+
+	fclose(file);
+	return retval;
+}
+
+
+/* start a new calm span at now, as if the trigger fired */
+static void cond_fired (struct psi_cond * restrict c, const uint64_t now)
+{
+	c->fired = now;
+	if (read_total(c, &c->total) != E_SUCCESS)
+		c->total = UINT64_MAX;
+}
+
+
+/* A condition is calm when the trigger has been quiet long enough, and the
+ * stall time counter confirms the stalls stayed below the threshold since
+ * the latest event. Otherwise a new calm span is started */
+static bool cond_calm (struct psi_cond * restrict c, const uint64_t now)
+{
+	uint64_t span = now - c->fired, total;
+
+	if (span < PSI_CALM_WINDOWS * c->window * 1000)
+		return false;
+
+	/* without the counter only the trigger is trusted */
+	if (c->total == UINT64_MAX || read_total(c, &total) != E_SUCCESS)
+		return true;
+
+	/* stalls at the rate of the threshold per window, or above */
+	if ((total - c->total) * c->window * 1000 >= c->threshold * span) {
+		c->fired = now;
+		c->total = total;
+		return false;
+	}
+
+	return true;
+}
+
+
+static void report (const struct psi_cond * const c)
+{
+	go(GO_MESS, "%s pressure is %s %lluus/%lluus\n", c->res,
+	   c->calm ? "below" : "above",
+	   (unsigned long long) c->threshold,
+	   (unsigned long long) c->window);
+	go_event_begin(GO_MESS, c->calm ? "pressure-below" : "pressure-above");
+	go_event_str("resource", c->res);
+	go_event_uint("threshold_us", c->threshold);
+	go_event_uint("window_us", c->window);
+	go_event_end();
+}
+
+
+int psi_add (const char * const spec)
+{
+	struct psi_cond *c = &conds[nconds];
+	char buf[PSI_TRIGGER_LEN];
+	char *colon, *slash;
+
+	if (nconds == PSI_MAX) {
+		go(GO_ERR, "Too many pressure conditions\n");
+		return E_FAIL;
+	}
+
+	if (snprintf(buf, PSI_TRIGGER_LEN, "%s", spec) >= PSI_TRIGGER_LEN)
+		return E_INVAL;
+
+	colon = strchr(buf, ':');
+	slash = colon ? strchr(colon, '/') : NULL;
+	if (slash == NULL)
+		return E_INVAL;
+	*colon = *slash = '\0';
+
+	c->res = NULL;
+	for (size_t i = 0; i < sizeof(resources) / sizeof(*resources); ++i)
+		if (!strcmp(buf, resources[i]))
+			c->res = resources[i];
+	if (c->res == NULL)
+		return E_INVAL;
+
+	if (strtousec(colon + 1, 1, &c->threshold) != E_SUCCESS ||
+	    strtousec(slash + 1, 1, &c->window) != E_SUCCESS ||
+	    c->threshold == 0 || c->threshold > c->window)
+		return E_INVAL;
+
+	c->fd = -1;
+	++nconds;
+
+	return E_SUCCESS;
+}
+
+
+bool psi_active (void)
+{
+	return nconds > 0;
+}
+
+
+int psi_start (void)
+{
+	uint64_t now = now_ns();
+
+	for (size_t i = 0; i < nconds; ++i) {
+		struct psi_cond *c = &conds[i];
+		char path[PROCFS_PATH_LEN], trigger[PSI_TRIGGER_LEN];
+		int len;
+
+		procfs_path(path, PROCFS_PATH_LEN, "pressure/%s", c->res);
+		c->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (c->fd == -1) {
+			go(GO_ERR, "Could not open '%s': %s\n", path,
+			   strerror(errno));
+			return E_FAIL;
+		}
+
+		/* the kernel wants the terminating '\0' too */
+		len = snprintf(trigger, PSI_TRIGGER_LEN, "some %llu %llu",
+			       (unsigned long long) c->threshold,
+			       (unsigned long long) c->window);
+		if (write(c->fd, trigger, (size_t) len + 1) == -1) {
+			go(GO_ERR, "Could not register %s pressure trigger "
+				   "'%s': %s\n", c->res, trigger,
+			   strerror(errno));
+			/* without CAP_SYS_RESOURCE the kernel only accepts
+			 * windows of whole multiples of two seconds */
+			if (errno == EINVAL && c->window % 2000000)
+				go(GO_ERR, "Unprivileged pressure windows must "
+					   "be multiples of 2s\n");
+			return E_FAIL;
+		}
+
+		/* the pressure is unknown until the windows have passed */
+		cond_fired(c, now);
+		c->calm = false;
+		go(GO_MESS, "Waiting for %s pressure to stay below "
+			    "%lluus/%lluus\n", c->res,
+		   (unsigned long long) c->threshold,
+		   (unsigned long long) c->window);
+	}
+
+	return E_SUCCESS;
+}
+
+
+size_t psi_pollfds (struct pollfd * fds)
+{
+	for (size_t i = 0; i < nconds; ++i) {
+		fds[i].fd = conds[i].fd;
+		fds[i].events = POLLPRI;
+		fds[i].revents = 0;
+	}
+
+	return nconds;
+}
+
+
+void psi_handle (const struct pollfd * const fds, const size_t n)
+{
+	uint64_t now = now_ns();
+
+	for (size_t i = 0; i < n && i < nconds; ++i) {
+		struct psi_cond *c = &conds[i];
+
+		if (fds[i].revents & POLLERR) {
+			/* the trigger is gone, treat it as met */
+			go(GO_WARN, "%s pressure trigger was removed\n",
+			   c->res);
+			close(c->fd);
+			c->fd = -1;
+			c->fired = 0;
+		} else if (fds[i].revents & POLLPRI) {
+			cond_fired(c, now);
+			if (c->calm) {
+				c->calm = false;
+				report(c);
+			}
+		}
+	}
+}
+
+
+bool psi_done (void)
+{
+	uint64_t now = now_ns();
+	bool done = true;
+
+	for (size_t i = 0; i < nconds; ++i) {
+		struct psi_cond *c = &conds[i];
+		bool calm = c->fd == -1 || c->calm || cond_calm(c, now);
+
+		if (calm != c->calm) {
+			c->calm = calm;
+			report(c);
+		}
+		done = done && calm;
+	}
+
+	return done;
+}
+
+
+uint64_t psi_timeout (void)
+{
+	uint64_t now = now_ns(), timeout = 0;
+
+	for (size_t i = 0; i < nconds; ++i) {
+		const struct psi_cond *c = &conds[i];
+		uint64_t calm_ns = PSI_CALM_WINDOWS * c->window * 1000;
+		uint64_t left;
+
+		if (c->fd == -1 || c->calm || now - c->fired >= calm_ns)
+			continue;
+
+		left = calm_ns - (now - c->fired);
+		if (left > timeout)
+			timeout = left;
+	}
+
+	return timeout;
+}
@@ -0,0 +1,46 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Waiting for pressure stall information (PSI) to calm down. A kernel
+ * trigger is registered on /proc/pressure/RESOURCE for each condition, and
+ * the trigger's fd becomes readable with POLLPRI whenever tasks stalled on
+ * the resource for more than the threshold within the window. A condition
+ * is met when its trigger has not fired for two windows, and the total
+ * stall time counter grew by less than the threshold per window since it
+ * last fired. */
+
+#ifndef PW_PSI_H
+#define PW_PSI_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* maximum number of pressure conditions */
+#define PSI_MAX 8
+
+/* add a condition RESOURCE:THRESHOLD/WINDOW, e.g. memory:100ms/1s */
+int psi_add (const char * const spec);
+
+/* check if any conditions were added */
+bool psi_active (void);
+
+/* register the kernel triggers */
+int psi_start (void);
+
+/* put the trigger fds to fds, which must have room for PSI_MAX fds. Returns
+ * the number of fds */
+size_t psi_pollfds (struct pollfd * fds);
+
+/* handle the results of polling the fds from psi_pollfds() */
+void psi_handle (const struct pollfd * const fds, const size_t n);
+
+/* check if all conditions are met */
+bool psi_done (void);
+
+/* time in ns until all conditions are met if no trigger fires, 0 if they
+ * are met already */
+uint64_t psi_timeout (void);
+
+#endif /* PW_PSI_H */
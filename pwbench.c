@@ -0,0 +1,451 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* pwbench: end-to-end benchmark of procwait.
+ *
+ * Usage: pwbench [-n COUNT] [-b BACKEND] [-i IDLE_MS] [-r ROUNDS]
+ *                [-k INTERVAL_MS] [-p PROCWAIT] [-- PROCWAIT_ARGS...]
+ *
+ * Spawns COUNT children and starts procwait to wait for them with
+ * --format json. Once procwait is waiting, the CPU time procwait uses is
+ * measured over IDLE_MS milliseconds. Then the children are killed in ROUNDS
+ * equal batches INTERVAL_MS apart, each child reaped right after it is
+ * killed. The detection latency of a child is the time from its reaping to
+ * the monotonic timestamp of its "terminated" event.
+ *
+ * BACKEND selects the wait backend of procwait:
+ *
+ *     poll	the default polling loop
+ *     latency	--latency with short polling every 100 microseconds
+ *
+ * The children and procwait are killed when pwbench dies, e.g. of SIGINT
+ * from interrupting make bench, so no paused orphans are left behind.
+ *
+ * The result is printed as a single line. */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGNAME "pwbench"
+#define LINE_LEN 4096
+#define PID_STR_LEN 16
+
+/* room left in ARG_MAX for what the kernel puts on the stack besides the
+ * arguments, such as the path of the program */
+#define ARG_SLACK 65536
+
+/* time procwait gets to report waiting for every child, ms */
+#define START_MS 60000
+
+struct child {
+	pid_t pid;
+	unsigned long long exited;	/* monotonic ns, 0 if alive */
+	unsigned long long detected;	/* monotonic ns, 0 if not reported */
+};
+
+static struct child *children;
+static size_t nchildren;
+
+/* buffered output of procwait */
+static char line[LINE_LEN];
+static size_t line_len = 0;
+static size_t nwaiting = 0;
+static size_t ndetected = 0;
+
+
+static unsigned long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000 +
+	       (unsigned long long) ts.tv_nsec;
+}
+
+
+static int cmp_child (const void *a, const void *b)
+{
+	const struct child *ca = a, *cb = b;
+
+	return (ca->pid > cb->pid) - (ca->pid < cb->pid);
+}
+
+
+static int cmp_ull (const void *a, const void *b)
+{
+	const unsigned long long *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+
+static struct child * find_child (const pid_t pid)
+{
+	struct child key = { pid, 0, 0 };
+
+	return bsearch(&key, children, nchildren, sizeof(*children),
+		       cmp_child);
+}
+
+
+/* value of a numeric field "key":N in a JSON line */
+static int json_ull (const char * const l, const char * const key,
+		     unsigned long long * restrict val)
+{
+	char pat[64];
+	const char *p;
+
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	p = strstr(l, pat);
+	if (p == NULL)
+		return -1;
+
+	*val = strtoull(p + strlen(pat), NULL, 10);
+	return 0;
+}
+
+
+static void handle_line (const char * const l)
+{
+	unsigned long long pid, mono;
+	struct child *c;
+
+	if (strstr(l, "\"event\":\"waiting\"") != NULL) {
+		++nwaiting;
+	} else if (strstr(l, "\"event\":\"terminated\"") != NULL &&
+		   json_ull(l, "pid", &pid) == 0 &&
+		   json_ull(l, "mono_ns", &mono) == 0) {
+		c = find_child((pid_t) pid);
+		if (c != NULL && c->detected == 0) {
+			c->detected = mono;
+			++ndetected;
+		}
+	}
+}
+
+
+/* read and handle the output of procwait for up to timeout_ms. Returns -1
+ * on EOF */
+static int drain (const int fd, const int timeout_ms)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	char buf[LINE_LEN];
+	ssize_t n;
+
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n <= 0)
+		return -1;
+
+	for (ssize_t i = 0; i < n; ++i) {
+		if (buf[i] == '\n') {
+			line[line_len] = '\0';
+			handle_line(line);
+			line_len = 0;
+		} else if (line_len < LINE_LEN - 1) {
+			line[line_len++] = buf[i];
+		}
+	}
+
+	return 0;
+}
+
+
+/* CPU time used by process pid in ns, from /proc/PID/schedstat */
+static unsigned long long cpu_ns (const pid_t pid)
+{
+	char path[64];
+	unsigned long long ns = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/schedstat", (int) pid);
+	f = fopen(path, "r");
+	if (f != NULL) {
+		if (fscanf(f, "%llu", &ns) != 1)
+			ns = 0;
+		fclose(f);
+	}
+
+	return ns;
+}
+
+
+/* kill procwait if it was started, and kill and reap the children still
+ * alive so that no paused orphans are left behind */
+static void cleanup (const pid_t pw)
+{
+	if (pw > 0) {
+		kill(pw, SIGTERM);
+		waitpid(pw, NULL, 0);
+	}
+
+	for (size_t i = 0; i < nchildren; ++i) {
+		if (children[i].exited != 0)
+			continue;
+		kill(children[i].pid, SIGKILL);
+		waitpid(children[i].pid, NULL, 0);
+		children[i].exited = now_ns();
+	}
+}
+
+
+/* The PIDs are passed to procwait as arguments, which with 100k children
+ * is more than the 2 MB ARG_MAX of the default 8 MB stack. The kernel
+ * allows arguments up to a quarter of the stack limit, so the limit is
+ * raised as far as needed and allowed. Returns -1 if argv doesn't fit */
+static int fit_args (char * const * const argv)
+{
+	extern char **environ;
+	struct rlimit rl;
+	size_t need = ARG_SLACK;
+
+	for (size_t i = 0; argv[i] != NULL; ++i)
+		need += strlen(argv[i]) + 1 + sizeof(char *);
+	for (size_t i = 0; environ[i] != NULL; ++i)
+		need += strlen(environ[i]) + 1 + sizeof(char *);
+
+	if (need <= (size_t) sysconf(_SC_ARG_MAX))
+		return 0;
+
+	if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+		rl.rlim_cur = rl.rlim_max == RLIM_INFINITY ||
+			      rl.rlim_max > 4 * need ? 4 * need : rl.rlim_max;
+		setrlimit(RLIMIT_STACK, &rl);
+	}
+
+	if (need <= (size_t) sysconf(_SC_ARG_MAX))
+		return 0;
+
+	fprintf(stderr, "%s: %zu bytes of arguments don't fit in ARG_MAX %ld\n",
+		PROGNAME, need, sysconf(_SC_ARG_MAX));
+	return -1;
+}
+
+
+static const char * backend_arg (const char * const backend)
+{
+	if (!strcmp(backend, "poll"))
+		return NULL;
+	if (!strcmp(backend, "latency"))
+		return "--latency=100us";
+
+	fprintf(stderr, "%s: unknown backend '%s'\n", PROGNAME, backend);
+	exit(1);
+}
+
+
+static void usage (void)
+{
+	fprintf(stderr, "Usage: %s [-n COUNT] [-b BACKEND] [-i IDLE_MS] "
+			"[-r ROUNDS] [-k INTERVAL_MS] [-p PROCWAIT] "
+			"[-- PROCWAIT_ARGS...]\n", PROGNAME);
+	exit(1);
+}
+
+
+int main (int argc, char **argv)
+{
+	const char *procwait = "./procwait";
+	const char *backend = "poll";
+	const char *barg;
+	long idle_ms = 2000, interval_ms = 50;
+	size_t rounds = 20;
+	char **pw_argv, *pid_strs;
+	size_t pw_argc = 0;
+	int pipefd[2], opt, status;
+	pid_t pw, self = getpid();
+	struct rusage ru;
+	unsigned long long cpu0, cpu1, t0, t1, deadline, *lat;
+	size_t nlat = 0;
+
+	nchildren = 100;
+	while ((opt = getopt(argc, argv, "n:b:i:r:k:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nchildren = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		case 'i':
+			idle_ms = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			interval_ms = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			procwait = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nchildren == 0 || rounds == 0)
+		usage();
+	if (rounds > nchildren)
+		rounds = nchildren;
+	barg = backend_arg(backend);
+
+	children = calloc(nchildren, sizeof(*children));
+	pid_strs = malloc(nchildren * PID_STR_LEN);
+	pw_argv = malloc((nchildren + (size_t) argc + 4) * sizeof(char *));
+	lat = malloc(nchildren * sizeof(*lat));
+	if (children == NULL || pid_strs == NULL || pw_argv == NULL ||
+	    lat == NULL) {
+		perror(PROGNAME);
+		return 1;
+	}
+
+	/* spawn the children to wait for */
+	for (size_t i = 0; i < nchildren; ++i) {
+		pid_t pid = fork();
+
+		if (pid == -1) {
+			perror("fork");
+			nchildren = i;
+			break;
+		} else if (pid == 0) {
+			/* pwbench may have died before the prctl() */
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			if (getppid() != self)
+				_exit(0);
+			for (;;)
+				pause();
+		}
+		children[i].pid = pid;
+	}
+	qsort(children, nchildren, sizeof(*children), cmp_child);
+
+	/* procwait --format json [BACKEND ARG] [PROCWAIT_ARGS] PID... */
+	pw_argv[pw_argc++] = (char *) procwait;
+	pw_argv[pw_argc++] = "--format";
+	pw_argv[pw_argc++] = "json";
+	if (barg != NULL)
+		pw_argv[pw_argc++] = (char *) barg;
+	for (int i = optind; i < argc; ++i)
+		pw_argv[pw_argc++] = argv[i];
+	for (size_t i = 0; i < nchildren; ++i) {
+		char *s = pid_strs + i * PID_STR_LEN;
+
+		snprintf(s, PID_STR_LEN, "%d", (int) children[i].pid);
+		pw_argv[pw_argc++] = s;
+	}
+	pw_argv[pw_argc] = NULL;
+
+	if (fit_args(pw_argv) != 0) {
+		cleanup(0);
+		return 1;
+	}
+
+	if (pipe(pipefd) == -1) {
+		perror("pipe");
+		cleanup(0);
+		return 1;
+	}
+
+	pw = fork();
+	if (pw == -1) {
+		perror("fork");
+		cleanup(0);
+		return 1;
+	} else if (pw == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() != self)
+			_exit(127);
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		execv(procwait, pw_argv);
+		perror(procwait);
+		_exit(127);
+	}
+	close(pipefd[1]);
+
+	/* wait until procwait has checked every child */
+	deadline = now_ns() + (unsigned long long) START_MS * 1000000;
+	while (nwaiting < nchildren) {
+		if (drain(pipefd[0], 1000) == -1) {
+			fprintf(stderr, "%s: procwait exited early\n",
+				PROGNAME);
+			cleanup(pw);
+			return 1;
+		}
+		if (now_ns() >= deadline) {
+			fprintf(stderr, "%s: procwait reported waiting for "
+					"only %zu of %zu children in %d s\n",
+				PROGNAME, nwaiting, nchildren, START_MS / 1000);
+			cleanup(pw);
+			return 1;
+		}
+	}
+
+	/* CPU used while idle waiting */
+	cpu0 = cpu_ns(pw);
+	t0 = now_ns();
+	while (now_ns() - t0 < (unsigned long long) idle_ms * 1000000)
+		drain(pipefd[0], 100);
+	cpu1 = cpu_ns(pw);
+	t1 = now_ns();
+
+	/* kill the children in batches */
+	for (size_t r = 0, i = 0; r < rounds; ++r) {
+		size_t end = (r + 1) * nchildren / rounds;
+		unsigned long long next = now_ns() +
+			(unsigned long long) interval_ms * 1000000;
+
+		for (; i < end; ++i) {
+			kill(children[i].pid, SIGKILL);
+			waitpid(children[i].pid, NULL, 0);
+			children[i].exited = now_ns();
+		}
+
+		for (unsigned long long t = now_ns(); t < next; t = now_ns())
+			drain(pipefd[0], (int) ((next - t) / 1000000));
+	}
+
+	/* read the rest of the output until procwait exits */
+	while (drain(pipefd[0], 1000) != -1)
+		;
+	wait4(pw, &status, 0, &ru);
+
+	for (size_t i = 0; i < nchildren; ++i) {
+		if (children[i].detected != 0)
+			lat[nlat++] = children[i].detected > children[i].exited ?
+				      children[i].detected - children[i].exited :
+				      0;
+	}
+	qsort(lat, nlat, sizeof(*lat), cmp_ull);
+
+	printf("n=%zu backend=%s args='", nchildren, backend);
+	for (int i = optind; i < argc; ++i)
+		printf(i > optind ? " %s" : "%s", argv[i]);
+	printf("' idle_cpu=%.3f%% ", 100.0 * (double) (cpu1 - cpu0) /
+				      (double) (t1 - t0));
+	if (nlat > 0) {
+		printf("latency_us min=%llu p50=%llu p99=%llu max=%llu ",
+		       lat[0] / 1000, lat[nlat / 2] / 1000,
+		       lat[nlat * 99 / 100] / 1000, lat[nlat - 1] / 1000);
+	}
+	printf("cpu_user=%ld.%03lds cpu_sys=%ld.%03lds detected=%zu/%zu\n",
+	       (long) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec / 1000,
+	       (long) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec / 1000,
+	       ndetected, nchildren);
+
+	return ndetected == nchildren ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* pwjournal: print the events in a procwait journal, oldest first */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define PROGNAME "pwjournal"
+
+
+/* copy record index n of the journal to out. returns 0 if the record was
+ * overwritten or being written while it was copied */
+static int read_rec (const struct journal_rec * const recs,
+		     const uint64_t capacity, const uint64_t n,
+		     struct journal_rec * restrict out)
+{
+	const struct journal_rec *r = &recs[n % capacity];
+	uint64_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+	memcpy(out, r, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return seq == n + 1 &&
+	       __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq;
+}
+
+
+static void print_rec (const struct journal_rec * const r)
+{
+	char timebuf[32];
+	time_t sec = (time_t) (r->time / 1000000000);
+	struct tm tm;
+
+	localtime_r(&sec, &tm);
+	strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tm);
+
+	printf("%s.%09llu %-11s pid %u t0 %llu tick %llu\n", timebuf,
+	       (unsigned long long) (r->time % 1000000000),
+	       journal_ev_name(r->type), r->pid,
+	       (unsigned long long) r->t0, (unsigned long long) r->tick);
+}
+
+
+int main (int argc, char **argv)
+{
+	const struct journal_hdr *hdr;
+	const struct journal_rec *recs;
+	struct stat st;
+	uint64_t head, first, skipped = 0;
+	int fd;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s JOURNAL\n", PROGNAME);
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if ((size_t) st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a procwait journal\n", argv[1]);
+		return 1;
+	}
+
+	hdr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	/* the capacity is bounded by dividing, as multiplying a corrupt one
+	 * could wrap around */
+	if (memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != JOURNAL_VERSION ||
+	    hdr->rec_size != sizeof(struct journal_rec) ||
+	    hdr->capacity == 0 ||
+	    hdr->capacity > ((size_t) st.st_size - sizeof(*hdr)) /
+			    sizeof(struct journal_rec)) {
+		fprintf(stderr, "%s: not a procwait journal\n", argv[1]);
+		return 1;
+	}
+
+	recs = (const struct journal_rec *) (hdr + 1);
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	first = head > hdr->capacity ? head - hdr->capacity : 0;
+
+	for (uint64_t n = first; n < head; ++n) {
+		struct journal_rec r;
+
+		if (read_rec(recs, hdr->capacity, n, &r))
+			print_rec(&r);
+		else
+			++skipped;
+	}
+
+	if (skipped)
+		fprintf(stderr, "%s: %llu records were overwritten while "
+				"reading\n", PROGNAME,
+			(unsigned long long) skipped);
+
+	return 0;
+}
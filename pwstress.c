@@ -0,0 +1,505 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* pwstress: check that procwait never mistakes a reused PID for the process
+ * it is waiting for.
+ *
+ * Usage: pwstress [-n COUNT] [-c CHURNERS] [-d SECONDS] [-m PID_MAX]
+ *                 [-p PROCWAIT] [-- PROCWAIT_ARGS...]
+ *
+ * Spawns COUNT targets and starts procwait to wait for them with
+ * --format json. Then CHURNERS processes fork short lived children as fast
+ * as they can to cycle through the PID space, while the targets are killed
+ * one by one over SECONDS seconds. If PID_MAX is given, kernel.pid_max is
+ * lowered to it for the duration of the run (needs root) so that PIDs wrap
+ * around within seconds; the old value is restored at the end, also when
+ * the run is cut short by an error, SIGINT or SIGTERM.
+ *
+ * The run fails if procwait reports a target terminated before it was
+ * killed, or if it doesn't report every target terminated within a few
+ * seconds after the last kill, i.e. it kept following a reused PID. For
+ * each detected target it is also checked whether its PID was already in
+ * use again, to tell how much reuse procwait actually saw.
+ *
+ * The result is printed as a single line. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGNAME "pwstress"
+#define LINE_LEN 4096
+#define PID_STR_LEN 16
+#define PID_MAX_PATH "/proc/sys/kernel/pid_max"
+
+/* longest life of a churn child, ms */
+#define CHURN_LIFE_MS 20
+
+/* time procwait gets to report the last targets, ms */
+#define GRACE_MS 5000
+
+struct target {
+	pid_t pid;
+	unsigned long long killed;	/* monotonic ns before kill, 0 if
+					 * alive */
+	unsigned long long detected;	/* monotonic ns, 0 if not reported */
+};
+
+static struct target *targets;
+static size_t ntargets;
+
+/* buffered output of procwait */
+static char line[LINE_LEN];
+static size_t line_len = 0;
+static size_t nwaiting = 0;
+static size_t ndetected = 0;
+static size_t npremature = 0;
+static size_t nreused = 0;
+
+/* churners that were actually started, and procwait */
+static pid_t *churners;
+static size_t nchurners_started = 0;
+static pid_t pw = 0;
+
+/* pid_max to restore. The string is formatted in advance so that the signal
+ * handler can write it */
+static long old_pid_max = 0;
+static char old_pid_max_str[PID_STR_LEN];
+
+
+static unsigned long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000 +
+	       (unsigned long long) ts.tv_nsec;
+}
+
+
+static int cmp_target (const void *a, const void *b)
+{
+	const struct target *ta = a, *tb = b;
+
+	return (ta->pid > tb->pid) - (ta->pid < tb->pid);
+}
+
+
+static struct target * find_target (const pid_t pid)
+{
+	struct target key = { pid, 0, 0 };
+
+	return bsearch(&key, targets, ntargets, sizeof(*targets),
+		       cmp_target);
+}
+
+
+static long read_pid_max (void)
+{
+	FILE *f = fopen(PID_MAX_PATH, "r");
+	long val = 0;
+
+	if (f != NULL) {
+		if (fscanf(f, "%ld", &val) != 1)
+			val = 0;
+		fclose(f);
+	}
+
+	return val;
+}
+
+
+/* write s to pid_max. Only async-signal-safe calls are used */
+static int write_pid_max_str (const char * const s)
+{
+	int fd = open(PID_MAX_PATH, O_WRONLY | O_CLOEXEC);
+	size_t len = strlen(s);
+	int retval = 0;
+
+	if (fd == -1)
+		return -1;
+
+	if (write(fd, s, len) != (ssize_t) len)
+		retval = -1;
+	if (close(fd) == -1)
+		retval = -1;
+
+	return retval;
+}
+
+
+static int write_pid_max (const long val)
+{
+	char s[PID_STR_LEN];
+
+	snprintf(s, sizeof(s), "%ld\n", val);
+	return write_pid_max_str(s);
+}
+
+
+static void restore_pid_max (void)
+{
+	if (old_pid_max != 0 && write_pid_max_str(old_pid_max_str) != 0)
+		fprintf(stderr, "%s: could not restore pid_max to %ld\n",
+			PROGNAME, old_pid_max);
+	old_pid_max = 0;
+}
+
+
+/* kill the churners, procwait and the targets still alive */
+static void kill_children (void)
+{
+	for (size_t i = 0; i < nchurners_started; ++i)
+		kill(churners[i], SIGKILL);
+	if (pw > 0)
+		kill(pw, SIGKILL);
+	for (size_t i = 0; i < ntargets; ++i) {
+		if (targets[i].pid > 0 && targets[i].killed == 0)
+			kill(targets[i].pid, SIGKILL);
+	}
+}
+
+
+/* kill and reap every child, orphaned churn children included, and restore
+ * pid_max */
+static void cleanup (void)
+{
+	kill_children();
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+	restore_pid_max();
+}
+
+
+static void on_signal (int sig)
+{
+	kill_children();
+	if (old_pid_max != 0)
+		write_pid_max_str(old_pid_max_str);
+	_exit(128 + sig);
+}
+
+
+/* value of a numeric field "key":N in a JSON line */
+static int json_ull (const char * const l, const char * const key,
+		     unsigned long long * restrict val)
+{
+	char pat[64];
+	const char *p;
+
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	p = strstr(l, pat);
+	if (p == NULL)
+		return -1;
+
+	*val = strtoull(p + strlen(pat), NULL, 10);
+	return 0;
+}
+
+
+static void handle_line (const char * const l)
+{
+	unsigned long long pid, mono;
+	struct target *t;
+	char path[64];
+
+	if (strstr(l, "\"event\":\"waiting\"") != NULL) {
+		++nwaiting;
+	} else if (strstr(l, "\"event\":\"terminated\"") != NULL &&
+		   json_ull(l, "pid", &pid) == 0 &&
+		   json_ull(l, "mono_ns", &mono) == 0) {
+		t = find_target((pid_t) pid);
+		if (t == NULL || t->detected != 0)
+			return;
+
+		t->detected = mono;
+		++ndetected;
+		if (t->killed == 0 || mono < t->killed) {
+			fprintf(stderr, "%s: PID %llu reported terminated "
+					"before it was killed\n", PROGNAME,
+				pid);
+			++npremature;
+		}
+
+		/* the PID was taken by another process by now */
+		snprintf(path, sizeof(path), "/proc/%llu", pid);
+		if (access(path, F_OK) == 0)
+			++nreused;
+	}
+}
+
+
+/* read and handle the output of procwait for up to timeout_ms. Returns -1
+ * on EOF */
+static int drain (const int fd, const int timeout_ms)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	char buf[LINE_LEN];
+	ssize_t n;
+
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n <= 0)
+		return -1;
+
+	for (ssize_t i = 0; i < n; ++i) {
+		if (buf[i] == '\n') {
+			line[line_len] = '\0';
+			handle_line(line);
+			line_len = 0;
+		} else if (line_len < LINE_LEN - 1) {
+			line[line_len++] = buf[i];
+		}
+	}
+
+	return 0;
+}
+
+
+/* fork children living up to CHURN_LIFE_MS until killed. The number of
+ * forks is added to *forks */
+static void churn (unsigned long long *forks)
+{
+	unsigned seed = (unsigned) getpid();
+
+	for (;;) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			struct timespec ts = { 0, (long) (rand_r(&seed) %
+					       CHURN_LIFE_MS) * 1000000 };
+
+			nanosleep(&ts, NULL);
+			_exit(0);
+		} else if (pid > 0) {
+			__atomic_add_fetch(forks, 1, __ATOMIC_RELAXED);
+		} else {
+			/* out of PIDs, let some children exit */
+			struct timespec ts = { 0, 1000000 };
+
+			nanosleep(&ts, NULL);
+		}
+
+		rand_r(&seed);
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+	}
+}
+
+
+static void usage (void)
+{
+	fprintf(stderr, "Usage: %s [-n COUNT] [-c CHURNERS] [-d SECONDS] "
+			"[-m PID_MAX] [-p PROCWAIT] [-- PROCWAIT_ARGS...]\n",
+		PROGNAME);
+	exit(1);
+}
+
+
+int main (int argc, char **argv)
+{
+	const char *procwait = "./procwait";
+	long pid_max = 0;
+	double seconds = 5;
+	size_t nchurners = 4;
+	char **pw_argv, *pid_strs;
+	size_t pw_argc = 0;
+	int pipefd[2], opt;
+	struct sigaction sa;
+	unsigned long long *forks, start, interval, deadline;
+	size_t *order;
+
+	ntargets = 1000;
+	while ((opt = getopt(argc, argv, "n:c:d:m:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			ntargets = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			nchurners = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'm':
+			pid_max = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			procwait = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (ntargets == 0 || seconds <= 0)
+		usage();
+
+	targets = calloc(ntargets, sizeof(*targets));
+	order = malloc(ntargets * sizeof(*order));
+	churners = malloc((nchurners ? nchurners : 1) * sizeof(*churners));
+	pid_strs = malloc(ntargets * PID_STR_LEN);
+	pw_argv = malloc((ntargets + (size_t) argc + 4) * sizeof(char *));
+	forks = mmap(NULL, sizeof(*forks), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (targets == NULL || order == NULL || churners == NULL ||
+	    pid_strs == NULL || pw_argv == NULL || forks == MAP_FAILED) {
+		perror(PROGNAME);
+		return 1;
+	}
+	*forks = 0;
+
+	/* orphaned churn children are reaped here, not by init */
+	prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* spawn the targets before shrinking the PID space */
+	for (size_t i = 0; i < ntargets; ++i) {
+		pid_t pid = fork();
+
+		if (pid == -1) {
+			perror("fork");
+			ntargets = i;
+			break;
+		} else if (pid == 0) {
+			for (;;)
+				pause();
+		}
+		targets[i].pid = pid;
+	}
+	qsort(targets, ntargets, sizeof(*targets), cmp_target);
+
+	/* procwait --format json [PROCWAIT_ARGS] PID... */
+	pw_argv[pw_argc++] = (char *) procwait;
+	pw_argv[pw_argc++] = "--format";
+	pw_argv[pw_argc++] = "json";
+	for (int i = optind; i < argc; ++i)
+		pw_argv[pw_argc++] = argv[i];
+	for (size_t i = 0; i < ntargets; ++i) {
+		char *s = pid_strs + i * PID_STR_LEN;
+
+		snprintf(s, PID_STR_LEN, "%d", (int) targets[i].pid);
+		pw_argv[pw_argc++] = s;
+	}
+	pw_argv[pw_argc] = NULL;
+
+	if (pipe(pipefd) == -1) {
+		perror("pipe");
+		cleanup();
+		return 1;
+	}
+
+	pw = fork();
+	if (pw == -1) {
+		perror("fork");
+		pw = 0;
+		cleanup();
+		return 1;
+	} else if (pw == 0) {
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		execv(procwait, pw_argv);
+		perror(procwait);
+		_exit(127);
+	}
+	close(pipefd[1]);
+
+	/* wait until procwait has checked every target */
+	while (nwaiting < ntargets) {
+		if (drain(pipefd[0], 1000) == -1) {
+			fprintf(stderr, "%s: procwait exited early\n",
+				PROGNAME);
+			cleanup();
+			return 1;
+		}
+	}
+
+	if (pid_max != 0) {
+		long val = read_pid_max();
+
+		snprintf(old_pid_max_str, sizeof(old_pid_max_str), "%ld\n",
+			 val);
+		old_pid_max = val;
+		if (write_pid_max(pid_max) != 0) {
+			fprintf(stderr, "%s: could not set pid_max: %s\n",
+				PROGNAME, strerror(errno));
+			old_pid_max = 0;
+		}
+	}
+
+	for (size_t i = 0; i < nchurners; ++i) {
+		pid_t pid = fork();
+
+		if (pid == -1) {
+			perror("fork");
+			break;
+		} else if (pid == 0) {
+			churn(forks);
+		}
+		churners[nchurners_started++] = pid;
+	}
+
+	/* kill the targets in random order, evenly over the run */
+	for (size_t i = 0; i < ntargets; ++i)
+		order[i] = i;
+	srand((unsigned) now_ns());
+	for (size_t i = ntargets - 1; i > 0; --i) {
+		size_t j = (size_t) rand() % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	start = now_ns();
+	interval = (unsigned long long) (seconds * 1e9) / ntargets;
+	for (size_t i = 0; i < ntargets; ++i) {
+		struct target *t = &targets[order[i]];
+		unsigned long long next = start + (i + 1) * interval;
+
+		t->killed = now_ns();
+		kill(t->pid, SIGKILL);
+		waitpid(t->pid, NULL, 0);
+
+		for (unsigned long long n = now_ns(); n < next; n = now_ns())
+			drain(pipefd[0], (int) ((next - n) / 1000000));
+	}
+
+	/* procwait should be done soon after the last kill */
+	deadline = now_ns() + (unsigned long long) GRACE_MS * 1000000;
+	while (ndetected < ntargets && now_ns() < deadline)
+		if (drain(pipefd[0], 100) == -1)
+			break;
+
+	cleanup();
+
+	for (size_t i = 0; i < ntargets; ++i) {
+		if (targets[i].detected == 0)
+			fprintf(stderr, "%s: PID %d was never reported "
+					"terminated\n", PROGNAME,
+				(int) targets[i].pid);
+	}
+
+	printf("n=%zu churners=%zu pid_max=%ld forks=%llu detected=%zu/%zu "
+	       "reused_at_detection=%zu premature=%zu\n", ntargets,
+	       nchurners_started, pid_max != 0 ? pid_max : read_pid_max(),
+	       *forks, ndetected, ntargets, nreused, npremature);
+
+	return ndetected == ntargets && npremature == 0 ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "proc.h"
+#include "procfs.h"
+#include "state.h"
+
+#define STATE_PATH_LEN PATH_MAX
+
+
+static int cmp_uint (const void *a, const void *b)
+{
+	const unsigned *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+
+/* read the id of the current boot. Left empty if it can't be read, which
+ * is the case with synthetic proc trees */
+static void read_boot_id (char * restrict buf)
+{
+	char path[PROCFS_PATH_LEN];
+	FILE *file;
+
+	memset(buf, 0, BOOT_ID_LEN);
+	if (procfs_path(path, PROCFS_PATH_LEN, "sys/kernel/random/boot_id")
+	    != E_SUCCESS)
+		return;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return;
+
+	if (fgets(buf, BOOT_ID_LEN, file) == NULL)
+		buf[0] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	fclose(file);
+}
+
+
+int state_save (const char * const path, const struct proclist * proclist)
+{
+	char tmp_path[STATE_PATH_LEN];
+	struct state_hdr hdr;
+	struct proc *proc;
+	FILE *file;
+	int fd;
+
+	if (snprintf(tmp_path, STATE_PATH_LEN, "%s.tmp", path) >=
+	    STATE_PATH_LEN)
+		return E_FAIL;
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return E_FAIL;
+	file = fdopen(fd, "w");
+	if (file == NULL) {
+		close(fd);
+		return E_FAIL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STATE_MAGIC, sizeof(hdr.magic));
+	hdr.version = STATE_VERSION;
+	hdr.rec_size = sizeof(struct state_rec);
+	read_boot_id(hdr.boot_id);
+	SLIST_FOREACH(proc, proclist, procs)
+		++hdr.count;
+	fwrite(&hdr, sizeof(hdr), 1, file);
+
+	SLIST_FOREACH(proc, proclist, procs) {
+		struct state_rec rec;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.pid = proc->pid;
+		rec.tgid = proc->tgid;
+		rec.t0 = proc->t0;
+		memcpy(rec.name, proc->name, PNAME_LEN);
+		fwrite(&rec, sizeof(rec), 1, file);
+	}
+
+	/* the new state must be on disk before it replaces the old one */
+	if (fflush(file) != 0 || fsync(fd) != 0) {
+		fclose(file);
+		unlink(tmp_path);
+		return E_FAIL;
+	}
+
+	if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		return E_FAIL;
+	}
+
+	return E_SUCCESS;
+}
+
+
+long state_load (const char * const path, const struct proclist * tracked,
+		 struct proclist * loaded)
+{
+	const struct state_hdr *hdr;
+	const struct state_rec *recs;
+	struct stat st;
+	struct proc *proc;
+	unsigned *pids = NULL;
+	size_t npids = 0;
+	long count;
+	char boot_id[BOOT_ID_LEN];
+	uint64_t nrecs;
+	int fd = open(path, O_RDONLY);
+
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) == -1 ||
+	    (size_t) st.st_size < sizeof(struct state_hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	hdr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return -1;
+
+	/* the count is checked by dividing, as multiplying a corrupt one
+	 * could wrap around */
+	if (memcmp(hdr->magic, STATE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != STATE_VERSION ||
+	    hdr->rec_size != sizeof(struct state_rec) ||
+	    hdr->count != ((size_t) st.st_size - sizeof(*hdr)) /
+			  sizeof(struct state_rec) ||
+	    ((size_t) st.st_size - sizeof(*hdr)) % sizeof(struct state_rec)) {
+		munmap((void *) hdr, (size_t) st.st_size);
+		return -1;
+	}
+
+	/* sorted PIDs of the already tracked processes for skipping them */
+	SLIST_FOREACH(proc, tracked, procs)
+		++npids;
+	if (npids > 0) {
+		pids = malloc(npids * sizeof(*pids));
+		if (pids == NULL) {
+			munmap((void *) hdr, (size_t) st.st_size);
+			return -1;
+		}
+		npids = 0;
+		SLIST_FOREACH(proc, tracked, procs)
+			pids[npids++] = proc->pid;
+		qsort(pids, npids, sizeof(*pids), cmp_uint);
+	}
+
+	/* after a reboot the same PIDs and start times are different
+	 * processes, so none of them is resumed */
+	read_boot_id(boot_id);
+	nrecs = strncmp(boot_id, hdr->boot_id, BOOT_ID_LEN) ? 0 : hdr->count;
+
+	recs = (const struct state_rec *) (hdr + 1);
+	for (uint64_t i = 0; i < nrecs; ++i) {
+		const struct state_rec *rec = &recs[i];
+		unsigned pid = rec->pid;
+		struct proc tmp = { .pid = 0 };
+		struct proc saved = { .pid = rec->pid, .tgid = rec->tgid };
+
+		if (pids != NULL &&
+		    bsearch(&pid, pids, npids, sizeof(*pids), cmp_uint))
+			continue;
+
+		/* one stat read tells if the process is still the same */
+		if (proc_sample(&saved, &tmp) != E_SUCCESS ||
+		    tmp.t0 != rec->t0)
+			continue;
+
+		proc = malloc(sizeof(struct proc));
+		if (proc == NULL)
+			break;
+		*proc = tmp;
+		SLIST_INSERT_HEAD(loaded, proc, procs);
+	}
+
+	count = (long) hdr->count;
+	free(pids);
+	munmap((void *) hdr, (size_t) st.st_size);
+	return count;
+}
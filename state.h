@@ -0,0 +1,50 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Checkpoints of the tracked processes. The state file is a header followed
+ * by fixed size records, one per tracked process, so it can be used in place
+ * through mmap. It is replaced atomically by writing a temporary file and
+ * renaming it over the old one. */
+
+#ifndef PW_STATE_H
+#define PW_STATE_H
+
+#include <stdint.h>
+
+#include "proc.h"
+
+#define STATE_MAGIC "PWSTATE"
+#define STATE_VERSION 2
+
+/* length of the text form of a boot id, including the '\0' */
+#define BOOT_ID_LEN 37
+
+struct state_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint64_t count;		/* number of records */
+	/* start times are only valid within a boot. The 3 bytes of padding
+	 * round the header up to 64 bytes, so that the records after it stay
+	 * 8 byte aligned */
+	char boot_id[BOOT_ID_LEN + 3];
+};
+
+struct state_rec {
+	uint32_t pid;
+	uint32_t tgid;		/* process of a thread, 0 if not a thread */
+	uint64_t t0;		/* start time, clock ticks after boot */
+	char name[PNAME_LEN];
+};
+
+/* write the processes on proclist to the state file at path */
+int state_save (const char * const path, const struct proclist * proclist);
+
+/* read the state file at path and put the processes which are still
+ * running to loaded. Processes whose PID is already on tracked are skipped.
+ * Returns the number of records in the file, or -1 if the file doesn't
+ * exist or is not a state file */
+long state_load (const char * const path, const struct proclist * tracked,
+		 struct proclist * loaded);
+
+#endif /* PW_STATE_H */
@@ -0,0 +1,199 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "go.h"
+#include "stats.h"
+
+/* bucket i holds durations in [2^(i-1), 2^i) ns, bucket 0 holds zeros */
+#define HIST_BUCKETS 64
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+static const char * const ctr_names[SC_COUNT] = {
+	"ticks",
+	"checks",
+	"opens",
+	"bytes read",
+	"exits"
+};
+
+/* field names for GO_JSON format */
+static const char * const ctr_keys[SC_COUNT] = {
+	"ticks",
+	"checks",
+	"opens",
+	"bytes",
+	"exits"
+};
+
+static const char * const hist_names[SH_COUNT] = {
+	"scan time",
+	"check time",
+	"detection latency"
+};
+
+static const char * const hist_keys[SH_COUNT] = {
+	"scan",
+	"check",
+	"latency"
+};
+
+static bool enabled = false;
+static uint64_t ctrs[SC_COUNT];
+static struct hist hists[SH_COUNT];
+
+
+static unsigned bucket_of (uint64_t ns)
+{
+	unsigned b = 0;
+
+	while (ns != 0 && b < HIST_BUCKETS - 1) {
+		ns >>= 1;
+		++b;
+	}
+
+	return b;
+}
+
+
+/* print a duration with a human friendly unit */
+static void print_ns (const char * const label, const uint64_t ns)
+{
+	if (ns < 10000)
+		go(GO_ESS, " %s %lluns", label, (unsigned long long) ns);
+	else if (ns < 10000000)
+		go(GO_ESS, " %s %lluus", label, (unsigned long long) ns / 1000);
+	else
+		go(GO_ESS, " %s %llums", label,
+		   (unsigned long long) ns / 1000000);
+}
+
+
+void stats_enable (void)
+{
+	enabled = true;
+}
+
+
+bool stats_enabled (void)
+{
+	return enabled;
+}
+
+
+uint64_t stats_clock (void)
+{
+	struct timespec ts;
+
+	if (!enabled)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+
+void stats_count (const enum STATS_CTR c, const uint64_t n)
+{
+	/* counters are also updated from scanner threads */
+	__atomic_fetch_add(&ctrs[c], n, __ATOMIC_RELAXED);
+}
+
+
+void stats_record (const enum STATS_HIST h, const uint64_t ns)
+{
+	struct hist *hp = &hists[h];
+
+	if (!enabled)
+		return;
+
+	if (hp->count == 0 || ns < hp->min)
+		hp->min = ns;
+	if (ns > hp->max)
+		hp->max = ns;
+	++hp->count;
+	hp->sum += ns;
+	++hp->buckets[bucket_of(ns)];
+}
+
+
+/* print statistics as a single event */
+static void stats_dump_json (void)
+{
+	char key[32];
+
+	go_event_begin(GO_ESS, "stats");
+
+	for (int i = 0; i < SC_COUNT; ++i)
+		go_event_uint(ctr_keys[i], ctrs[i]);
+
+	for (int i = 0; i < SH_COUNT; ++i) {
+		const struct hist *hp = &hists[i];
+
+		snprintf(key, sizeof(key), "%s_count", hist_keys[i]);
+		go_event_uint(key, hp->count);
+		if (hp->count == 0)
+			continue;
+
+		snprintf(key, sizeof(key), "%s_min_ns", hist_keys[i]);
+		go_event_uint(key, hp->min);
+		snprintf(key, sizeof(key), "%s_avg_ns", hist_keys[i]);
+		go_event_uint(key, hp->sum / hp->count);
+		snprintf(key, sizeof(key), "%s_max_ns", hist_keys[i]);
+		go_event_uint(key, hp->max);
+		snprintf(key, sizeof(key), "%s_log2_ns", hist_keys[i]);
+		go_event_uints(key, hp->buckets, bucket_of(hp->max) + 1);
+	}
+
+	go_event_end();
+}
+
+
+void stats_dump (void)
+{
+	if (go_format() == GO_JSON) {
+		stats_dump_json();
+		return;
+	}
+
+	go(GO_ESS, "Statistics:\n");
+
+	for (int i = 0; i < SC_COUNT; ++i) {
+		go(GO_ESS, "  %-18s %llu\n", ctr_names[i],
+		   (unsigned long long) ctrs[i]);
+	}
+
+	for (int i = 0; i < SH_COUNT; ++i) {
+		const struct hist *hp = &hists[i];
+
+		go(GO_ESS, "  %-18s count %llu", hist_names[i],
+		   (unsigned long long) hp->count);
+		if (hp->count == 0) {
+			go(GO_ESS, "\n");
+			continue;
+		}
+
+		print_ns("min", hp->min);
+		print_ns("avg", hp->sum / hp->count);
+		print_ns("max", hp->max);
+		go(GO_ESS, "\n");
+
+		for (int b = 0; b < HIST_BUCKETS; ++b) {
+			if (hp->buckets[b] == 0)
+				continue;
+			go(GO_ESS, "    < 2^%-2d ns %llu\n", b,
+			   (unsigned long long) hp->buckets[b]);
+		}
+	}
+}
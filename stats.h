@@ -0,0 +1,49 @@
+/* Copyright 2017 Tuomo Hartikainen <tth@harski.org>.
+ * Licensed under the 2-clause BSD license, see LICENSE for details. */
+
+/* Self instrumentation. Counters are always kept as they cost next to
+ * nothing; timings are only taken when stats are enabled with
+ * stats_enable(). Durations are collected to histograms with power of two
+ * buckets. */
+
+#ifndef PW_STATS_H
+#define PW_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum STATS_CTR {
+	SC_TICKS,	/* passes of the wait loop */
+	SC_CHECKS,	/* process checks */
+	SC_OPENS,	/* files and directories opened */
+	SC_BYTES,	/* bytes parsed from /proc */
+	SC_EXITS,	/* detected terminations */
+	SC_COUNT
+};
+
+enum STATS_HIST {
+	SH_SCAN,	/* duration of a pass over all tracked processes */
+	SH_PARSE,	/* duration of a single process check */
+	SH_LATENCY,	/* estimated delay between termination and detection */
+	SH_COUNT
+};
+
+/* start collecting timings */
+void stats_enable (void);
+
+/* check if timings are collected */
+bool stats_enabled (void);
+
+/* monotonic time in nanoseconds, or 0 if stats are disabled */
+uint64_t stats_clock (void);
+
+/* add n to counter c */
+void stats_count (const enum STATS_CTR c, const uint64_t n);
+
+/* add a duration of ns nanoseconds to histogram h if stats are enabled */
+void stats_record (const enum STATS_HIST h, const uint64_t ns);
+
+/* print all counters and histograms */
+void stats_dump (void);
+
+#endif /* PW_STATS_H */
@@ -1,11 +1,12 @@
 /* Copyright 2014-2015 Tuomo Hartikainen <tth@harski.org>.
  * Licensed under the 2-clause BSD license, see LICENSE for details. */
 
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "error.h"
 #include "go.h"
@@ -14,59 +15,14 @@
 #define WHITESPACE "\t\n "
 
 
-int get_next_field (FILE * fd, char * str, const size_t len)
-{
-	int success;
-	int i;
-
-	for (i = 0; ; ++i) {
-		int tmp_char = fgetc(fd);
-
-		if (tmp_char == EOF) {
-			str[i] = '\0';
-			success = STRUTIL_EXIT_EOF;
-			break;
-		} else if (is_whitespace((char) tmp_char)) {
-			str[i] = '\0';
-			success = STRUTIL_EXIT_SUCCESS;
-			break;
-		} else if (i == (int) len -1) {
-			/* No more room for characters, and tmp_char is
-			 * non-whitespace. terminate string and
-			 * fast-forward until next whitespace. */
-			str[i] = '\0';
-			success = STRUTIL_EXIT_TRUNCATED;
-			skip_field(fd);
-			break;
-		} else {
-			str[i] = (char) tmp_char;
-		}
-	}
-
-	return success;
-}
-
-
 bool is_whitespace (const char c)
 {
-    int i = 0;
-    while (WHITESPACE[i++] != '\0') {
-        if (c == WHITESPACE[i])
-            return true;
-    }
-
-    return false;
-}
-
-
-int skip_field (FILE * fd)
-{
-	int tmp_char;
-	do {
-		tmp_char = fgetc(fd);
-	} while (tmp_char != EOF && !is_whitespace((char) tmp_char));
+	for (int i = 0; WHITESPACE[i] != '\0'; ++i) {
+		if (c == WHITESPACE[i])
+			return true;
+	}
 
-	return tmp_char;
+	return false;
 }
 
 
@@ -91,3 +47,62 @@ int strtou (const char * const str, unsigned * restrict u)
 
 	return succ;
 }
+
+
+int strtou64 (const char * const str, uint64_t * restrict u)
+{
+	int succ = E_SUCCESS;
+	unsigned long long ull;
+	char *endptr;
+
+	errno = 0;
+	ull = strtoull(str, &endptr, 10);
+
+	/* if result overflows ullong ||
+	 *    str doesn't start with a digit (strtoull accepts leading
+	 *    whitespace and a sign, and wraps negative numbers) ||
+	 *    the str was a valid ull */
+	if ((ull == ULLONG_MAX && errno == ERANGE) ||
+	    !isdigit((unsigned char) *str) || *endptr != '\0') {
+		succ = E_FAIL;
+	} else {
+		*u = (uint64_t) ull;
+	}
+
+	return succ;
+}
+
+
+int strtousec (const char * const str, const uint64_t unit_us,
+	       uint64_t * restrict usec)
+{
+	unsigned long long ull;
+	uint64_t unit;
+	char *endptr;
+
+	/* strtoull would skip whitespace and wrap negative numbers */
+	if (!isdigit((unsigned char) *str))
+		return E_FAIL;
+
+	errno = 0;
+	ull = strtoull(str, &endptr, 10);
+	if (errno == ERANGE)
+		return E_FAIL;
+
+	if (*endptr == '\0')
+		unit = unit_us;
+	else if (!strcmp(endptr, "us"))
+		unit = 1;
+	else if (!strcmp(endptr, "ms"))
+		unit = 1000;
+	else if (!strcmp(endptr, "s"))
+		unit = 1000000;
+	else
+		return E_FAIL;
+
+	if (ull > UINT64_MAX / unit)
+		return E_FAIL;
+
+	*usec = (uint64_t) ull * unit;
+	return E_SUCCESS;
+}
@@ -5,21 +5,24 @@
 #define PW_STRUTIL
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define STRUTIL_EXIT_SUCCESS 1
 #define STRUTIL_EXIT_EOF 2
 #define STRUTIL_EXIT_TRUNCATED 3
 
-/* get next whitespace separated field from fd */
-int get_next_field (FILE * fd, char * str, const size_t len);
-
 /* check if char c is \t, \n or ' ' */
 bool is_whitespace (const char c);
 
-/* skip fd until whitespace is found */
-int skip_field (FILE * fd);
-
 /* parse str to unsigned int */
 int strtou (const char * const str, unsigned * restrict u);
 
+/* parse str to a 64-bit unsigned int */
+int strtou64 (const char * const str, uint64_t * restrict u);
+
+/* parse a duration with an optional unit suffix "us", "ms" or "s" to
+ * microseconds. A number without a suffix is in units of unit_us */
+int strtousec (const char * const str, const uint64_t unit_us,
+	       uint64_t * restrict usec);
+
 #endif